@@ -0,0 +1,42 @@
+// interface to ray acceleration structures
+#ifndef ACCEL_HPP
+#define ACCEL_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Intersection.hpp"
+#include "Ray.hpp"
+
+// system includes necessary for the interface
+#include <stddef.h>
+
+// anything that can answer closest-hit and any-hit queries over the scene;
+// both count toward the ObjectList ray statistics
+class Accel {
+public: // destructor
+    virtual ~Accel() {}
+
+public: // queries
+    // closest intersection along r
+    virtual Intersection trace(const Ray &r) const = 0;
+
+    // true if anything is hit between r.near and r.far
+    virtual bool probe(const Ray &r) const = 0;
+
+    // closest intersections for count rays at once, for structures that
+    // gain from seeing many rays together; one at a time by default
+    virtual void traceBatch(const Ray *rays, Intersection *hits, int count) const {
+        for (int i = 0; i < count; ++i)
+            hits[i] = trace(rays[i]);
+    }
+
+public: // copies
+    // a copy that shares the objects, such as one for another NUMA node;
+    // null if the structure can't be copied
+    virtual Accel *clone() const { return nullptr; }
+
+public: // statistics
+    // bytes held by the structure, not counting the objects
+    virtual size_t bytes() const = 0;
+};
+
+#endif
@@ -0,0 +1,285 @@
+// implementation code for BVH class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "BVH.hpp"
+
+// system includes
+#include <algorithm>
+
+// SAH bins per split
+static const int BinCount = 16;
+
+// below this many levels of room, splits are plain median splits, which
+// halve the slot count and so always finish within MaxDepth
+static const int MedianLevels = 32;
+
+// box grown to hold another
+static void grow(BVHBox &box, const BVHBox &b)
+{
+    for (int a = 0; a < 3; ++a) {
+        box.lo[a] = std::min(box.lo[a], b.lo[a]);
+        box.hi[a] = std::max(box.hi[a], b.hi[a]);
+    }
+}
+
+static float area(const BVHBox &box)
+{
+    float dx = box.hi[0] - box.lo[0];
+    float dy = box.hi[1] - box.lo[1];
+    float dz = box.hi[2] - box.lo[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+static const BVHBox EmptyBox = {
+    { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY }
+};
+
+void BVH::build(const std::vector<BVHBox> &boxes, int maxLeaf)
+{
+    int n = int(boxes.size());
+    nodes.clear();
+    order.resize(n);
+    for (int i = 0; i < n; ++i)
+        order[i] = i;
+    depth = 0;
+    if (n == 0) return;
+
+    nodes.reserve(2 * ((n + maxLeaf - 1) / maxLeaf) + 1);
+    nodes.push_back(BVHNode());
+    build(0, 0, n, 0, maxLeaf, boxes);
+    nodes.shrink_to_fit();
+}
+
+void BVH::build(int node, int begin, int end, int level, int maxLeaf,
+                const std::vector<BVHBox> &boxes)
+{
+    depth = std::max(depth, level);
+
+    // bounds of the boxes and of their centers
+    BVHBox box = EmptyBox, centers = EmptyBox;
+    for (int i = begin; i < end; ++i) {
+        const BVHBox &b = boxes[order[i]];
+        grow(box, b);
+        BVHBox c;
+        for (int a = 0; a < 3; ++a)
+            c.lo[a] = c.hi[a] = 0.5f * (b.lo[a] + b.hi[a]);
+        grow(centers, c);
+    }
+    BVHNode &n = nodes[node];
+    std::copy(box.lo, box.lo + 3, n.lo);
+    std::copy(box.hi, box.hi + 3, n.hi);
+    n.axis = 0;
+
+    int count = end - begin;
+    if (count <= maxLeaf || level >= MaxDepth) {
+        n.offset = begin;
+        n.count = (unsigned short)count;
+        return;
+    }
+
+    // split on the axis with the widest spread of centers
+    int axis = 0;
+    for (int a = 1; a < 3; ++a)
+        if (centers.hi[a] - centers.lo[a] > centers.hi[axis] - centers.lo[axis])
+            axis = a;
+    float cmin = centers.lo[axis], extent = centers.hi[axis] - centers.lo[axis];
+
+    int mid = begin;
+    if (extent > 0 && level < MaxDepth - MedianLevels) {
+        // bin by center, then sweep for the cheapest surface area split
+        int binCount[BinCount] = {};
+        BVHBox binBox[BinCount];
+        std::fill(binBox, binBox + BinCount, EmptyBox);
+        float scale = BinCount / extent;
+        auto binOf = [&](int item) {
+            const BVHBox &b = boxes[item];
+            int bin = int((0.5f * (b.lo[axis] + b.hi[axis]) - cmin) * scale);
+            return std::min(std::max(bin, 0), BinCount - 1);
+        };
+        for (int i = begin; i < end; ++i) {
+            int bin = binOf(order[i]);
+            ++binCount[bin];
+            grow(binBox[bin], boxes[order[i]]);
+        }
+
+        float rightArea[BinCount];
+        int rightCount[BinCount];
+        BVHBox acc = EmptyBox;
+        int accCount = 0;
+        for (int b = BinCount - 1; b > 0; --b) {
+            grow(acc, binBox[b]);
+            accCount += binCount[b];
+            rightArea[b] = accCount ? area(acc) : 0;
+            rightCount[b] = accCount;
+        }
+
+        int best = 0;
+        float bestCost = INFINITY;
+        acc = EmptyBox;
+        accCount = 0;
+        for (int b = 1; b < BinCount; ++b) {
+            grow(acc, binBox[b - 1]);
+            accCount += binCount[b - 1];
+            if (accCount == 0 || rightCount[b] == 0) continue;
+            float cost = accCount * area(acc) + rightCount[b] * rightArea[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = b;
+            }
+        }
+
+        // a leaf is cheaper than any split
+        float leafCost = count * area(box);
+        if (best == 0 || (bestCost >= leafCost && count <= maxLeaf * 4)) {
+            n.offset = begin;
+            n.count = (unsigned short)count;
+            return;
+        }
+
+        mid = int(std::partition(order.begin() + begin, order.begin() + end,
+                                 [&](int item) { return binOf(item) < best; })
+                  - order.begin());
+    }
+
+    // no usable SAH split: halve the slots by center
+    if (mid == begin || mid == end) {
+        mid = begin + count / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&](int i0, int i1) {
+                return boxes[i0].lo[axis] + boxes[i0].hi[axis] <
+                       boxes[i1].lo[axis] + boxes[i1].hi[axis];
+            });
+    }
+
+    int left = int(nodes.size());
+    nodes.push_back(BVHNode());
+    build(left, begin, mid, level + 1, maxLeaf, boxes);
+    int right = int(nodes.size());
+    nodes.push_back(BVHNode());
+    build(right, mid, end, level + 1, maxLeaf, boxes);
+
+    BVHNode &parent = nodes[node];
+    parent.offset = right;
+    parent.count = 0;
+    parent.axis = (unsigned short)axis;
+}
+
+// spread the low 10 bits of v out to every third bit
+static uint32_t spreadBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+std::vector<uint32_t> BVH::mortonCodes(const std::vector<BVHBox> &boxes)
+{
+    BVHBox all = EmptyBox;
+    for (const auto &b : boxes)
+        grow(all, b);
+
+    std::vector<uint32_t> codes(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        uint32_t q[3];
+        for (int a = 0; a < 3; ++a) {
+            float extent = all.hi[a] - all.lo[a];
+            float c = 0.5f * (boxes[i].lo[a] + boxes[i].hi[a]);
+            float f = extent > 0 ? (c - all.lo[a]) / extent : 0;
+            q[a] = uint32_t(std::min(std::max(f * 1024, 0.f), 1023.f));
+        }
+        // x in the highest bit of each triple, then y, then z
+        codes[i] = spreadBits(q[0]) << 2 | spreadBits(q[1]) << 1 | spreadBits(q[2]);
+    }
+    return codes;
+}
+
+void BVH::buildLinear(const std::vector<BVHBox> &boxes, int maxLeaf)
+{
+    int n = int(boxes.size());
+    nodes.clear();
+    depth = 0;
+    order.resize(n);
+    if (n == 0) return;
+
+    // sort slots by code, ties in input order
+    std::vector<uint32_t> codes = mortonCodes(boxes);
+    std::vector<uint64_t> keys(n);
+    for (int i = 0; i < n; ++i)
+        keys[i] = uint64_t(codes[i]) << 32 | uint32_t(i);
+    std::sort(keys.begin(), keys.end());
+    for (int i = 0; i < n; ++i) {
+        order[i] = int(keys[i] & 0xffffffffu);
+        codes[i] = uint32_t(keys[i] >> 32);
+    }
+    std::vector<uint64_t>().swap(keys);
+
+    nodes.reserve(2 * ((n + maxLeaf - 1) / maxLeaf) + 1);
+    nodes.push_back(BVHNode());
+    buildLinear(0, 0, n, 0, maxLeaf, boxes, codes);
+    nodes.shrink_to_fit();
+}
+
+// Ranges split where the sorted codes first have their highest differing
+// bit set, a plain binary search. Bounds are gathered bottom up, so the
+// whole build is one sort plus linear work.
+void BVH::buildLinear(int node, int begin, int end, int level, int maxLeaf,
+                      const std::vector<BVHBox> &boxes,
+                      const std::vector<uint32_t> &codes)
+{
+    depth = std::max(depth, level);
+    int count = end - begin;
+
+    if (count <= maxLeaf || level >= MaxDepth) {
+        BVHBox box = EmptyBox;
+        for (int i = begin; i < end; ++i)
+            grow(box, boxes[order[i]]);
+        BVHNode &n = nodes[node];
+        std::copy(box.lo, box.lo + 3, n.lo);
+        std::copy(box.hi, box.hi + 3, n.hi);
+        n.offset = begin;
+        n.count = (unsigned short)count;
+        n.axis = 0;
+        return;
+    }
+
+    // identical codes are halved instead
+    int mid = begin + count / 2, axis = 0;
+    uint32_t diff = codes[begin] ^ codes[end - 1];
+    if (diff) {
+        int bit = 31;
+        while (!(diff >> bit & 1)) --bit;
+        mid = int(std::upper_bound(codes.begin() + begin, codes.begin() + end,
+                                   codes[begin] | ((1u << bit) - 1)) - codes.begin());
+        axis = 2 - bit % 3;
+    }
+
+    int left = int(nodes.size());
+    nodes.push_back(BVHNode());
+    buildLinear(left, begin, mid, level + 1, maxLeaf, boxes, codes);
+    int right = int(nodes.size());
+    nodes.push_back(BVHNode());
+    buildLinear(right, mid, end, level + 1, maxLeaf, boxes, codes);
+
+    BVHNode &n = nodes[node];
+    const BVHNode &l = nodes[left], &r = nodes[right];
+    for (int a = 0; a < 3; ++a) {
+        n.lo[a] = std::min(l.lo[a], r.lo[a]);
+        n.hi[a] = std::max(l.hi[a], r.hi[a]);
+    }
+    n.offset = right;
+    n.count = 0;
+    n.axis = (unsigned short)axis;
+}
+
+void BVH::bounds(Vec3 &lo, Vec3 &hi) const
+{
+    if (nodes.empty()) {
+        lo = hi = Vec3(0,0,0);
+        return;
+    }
+    lo = Vec3(nodes[0].lo[0], nodes[0].lo[1], nodes[0].lo[2]);
+    hi = Vec3(nodes[0].hi[0], nodes[0].hi[1], nodes[0].hi[2]);
+}
@@ -0,0 +1,165 @@
+// bounding volume hierarchy over boxes
+#ifndef BVH_HPP
+#define BVH_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// axis-aligned box in single precision
+struct BVHBox {
+    float lo[3], hi[3];
+};
+
+// 32-byte node; an interior node's first child immediately follows it
+struct BVHNode {
+    float lo[3], hi[3];     // bounds of everything below
+    int offset;             // leaf: first slot in order; interior: second child
+    unsigned short count;   // leaf: number of slots; interior: 0
+    unsigned short axis;    // interior: split axis, to visit the near child first
+};
+
+// Binned SAH or Morton-code (linear) hierarchy over an array of item boxes.
+// The caller keeps its own items and stores them in slot order (item
+// order[s] in slot s) so leaves read contiguous memory. Queries pass a leaf
+// functor that tests a range of slots.
+class BVH {
+public: // public data
+    std::vector<BVHNode> nodes;     // root first
+    std::vector<int> order;         // item index for each leaf slot
+
+    // deepest path, never more than MaxDepth
+    int depth;
+    static const int MaxDepth = 96;
+
+public: // constructor
+    BVH() : depth(0) {}
+
+public: // build
+    // build over boxes with at most maxLeaf items per leaf where possible
+    void build(const std::vector<BVHBox> &boxes, int maxLeaf = 4);
+
+    // linear BVH: sort boxes by the Morton code of their centers and split
+    // each range at its highest differing code bit; much faster to build
+    // than build() but traces somewhat slower
+    void buildLinear(const std::vector<BVHBox> &boxes, int maxLeaf = 4);
+
+    // 30-bit Morton code of each box center, on a 1024^3 grid over the
+    // union of all boxes
+    static std::vector<uint32_t> mortonCodes(const std::vector<BVHBox> &boxes);
+
+    // bounds of everything, or an empty box at the origin if there is nothing
+    void bounds(Vec3 &lo, Vec3 &hi) const;
+
+public: // queries
+    // Visit leaves along ray front to back while they may hold hits before
+    // far. leaf(first, count, far) tests slots [first, first+count) and
+    // lowers far to any closer hit.
+    template <class Leaf>
+    void closest(const Ray &ray, Real &far, Leaf leaf) const;
+
+    // Stop at the first leaf for which leaf(first, count) returns true.
+    template <class Leaf>
+    bool any(const Ray &ray, Leaf leaf) const;
+
+    // the same over nodes stored elsewhere, such as a mapped file
+    template <class Leaf>
+    static void closest(const BVHNode *nodes, const Ray &ray, Real &far, Leaf leaf);
+    template <class Leaf>
+    static bool any(const BVHNode *nodes, const Ray &ray, Leaf leaf);
+
+private:
+    // recursive builder for slots [begin,end) into node
+    void build(int node, int begin, int end, int level, int maxLeaf,
+               const std::vector<BVHBox> &boxes);
+
+    // recursive linear builder for slots [begin,end) with sorted codes
+    void buildLinear(int node, int begin, int end, int level, int maxLeaf,
+                     const std::vector<BVHBox> &boxes,
+                     const std::vector<uint32_t> &codes);
+
+    // slab test against ray origin E and inverse direction inv, entering
+    // each slab on the side sign picks
+    static bool hitBox(const BVHNode &n, const Real E[3], const Real inv[3],
+                       const int sign[3], Real near, Real far) {
+        const float *side[2] = { n.lo, n.hi };
+        for (int a = 0; a < 3; ++a) {
+            Real t0 = (side[sign[a]][a] - E[a]) * inv[a];
+            Real t1 = (side[1 - sign[a]][a] - E[a]) * inv[a];
+            near = t0 > near ? t0 : near;
+            far = t1 < far ? t1 : far;
+        }
+        return near <= far;
+    }
+};
+
+template <class Leaf>
+void BVH::closest(const Ray &ray, Real &far, Leaf leaf) const
+{
+    if (!nodes.empty())
+        closest(nodes.data(), ray, far, leaf);
+}
+
+template <class Leaf>
+bool BVH::any(const Ray &ray, Leaf leaf) const
+{
+    return !nodes.empty() && any(nodes.data(), ray, leaf);
+}
+
+template <class Leaf>
+void BVH::closest(const BVHNode *nodes, const Ray &ray, Real &far, Leaf leaf)
+{
+    Real E[3] = { ray.E[0], ray.E[1], ray.E[2] };
+    Real inv[3] = { ray.invD[0], ray.invD[1], ray.invD[2] };
+
+    int stack[MaxDepth + 1], top = 0, node = 0;
+    for (;;) {
+        const BVHNode &n = nodes[node];
+        if (hitBox(n, E, inv, ray.sign, ray.near, far)) {
+            if (n.count)
+                leaf(n.offset, int(n.count), far);
+            else {
+                // near child first, far child later
+                int first = node + 1, second = n.offset;
+                if (ray.sign[n.axis]) std::swap(first, second);
+                stack[top++] = second;
+                node = first;
+                continue;
+            }
+        }
+        if (top == 0) return;
+        node = stack[--top];
+    }
+}
+
+template <class Leaf>
+bool BVH::any(const BVHNode *nodes, const Ray &ray, Leaf leaf)
+{
+    Real E[3] = { ray.E[0], ray.E[1], ray.E[2] };
+    Real inv[3] = { ray.invD[0], ray.invD[1], ray.invD[2] };
+
+    int stack[MaxDepth + 1], top = 0, node = 0;
+    for (;;) {
+        const BVHNode &n = nodes[node];
+        if (hitBox(n, E, inv, ray.sign, ray.near, ray.far)) {
+            if (n.count) {
+                if (leaf(n.offset, int(n.count)))
+                    return true;
+            }
+            else {
+                stack[top++] = n.offset;
+                node = node + 1;
+                continue;
+            }
+        }
+        if (top == 0) return false;
+        node = stack[--top];
+    }
+}
+
+#endif
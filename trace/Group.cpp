@@ -0,0 +1,46 @@
+// implementation code for Group class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Group.hpp"
+
+// other classes used directly in the implementation
+#include "KDTree.hpp"
+#include "Object.hpp"
+
+// system includes
+#include <algorithm>
+
+Group::Group(const std::string &_name)
+    : name(_name), tree(nullptr)
+{}
+
+Group::~Group()
+{
+    delete tree;
+}
+
+void Group::rebuild()
+{
+    if (!tree) return;
+    delete tree;
+    tree = nullptr;
+    build();
+}
+
+void Group::build()
+{
+    if (tree) return;
+
+    tree = new KDTree(&objects);
+
+    lo = hi = Vec3(0,0,0);
+    for (size_t i = 0; i < objects.objects.size(); ++i) {
+        Vec3 olo, ohi;
+        objects.objects[i]->bounds(olo, ohi);
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = i == 0 ? olo[a] : std::min(lo[a], olo[a]);
+            hi[a] = i == 0 ? ohi[a] : std::max(hi[a], ohi[a]);
+        }
+    }
+}
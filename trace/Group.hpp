@@ -0,0 +1,40 @@
+// named groups of objects for instancing
+#ifndef GROUP_HPP
+#define GROUP_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "ObjectList.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <string>
+
+// classes we only use by pointer or reference
+class KDTree;
+
+// A group holds one copy of some geometry in its own object space, with
+// its own acceleration structure. Instances place it in the world.
+class Group {
+public: // public data
+    std::string name;       // name used by instance statements
+    ObjectList objects;     // objects in object space, owned by the scene arena
+    KDTree *tree;           // built once by build(), shared by all instances
+    Vec3 lo, hi;            // object-space bounds, valid after build()
+
+public: // constructor & destructor
+    Group(const std::string &_name);
+    ~Group();
+
+    // groups own a tree, so no copies
+    Group(const Group&) = delete;
+    Group &operator=(const Group&) = delete;
+
+public: // manipulators
+    // build the group's tree and bounds; later calls do nothing
+    void build();
+
+    // build again if built, after the objects have moved
+    void rebuild();
+};
+
+#endif
@@ -0,0 +1,84 @@
+// implementation code for Instance object class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Instance.hpp"
+
+// other classes used directly in the implementation
+#include "SceneArena.hpp"
+#include "Group.hpp"
+#include "KDTree.hpp"
+#include "Ray.hpp"
+
+// system includes
+#include <algorithm>
+
+Instance::Instance(const Group *_group, const Transform &_toWorld)
+    : group(_group), toWorld(_toWorld), toObject(_toWorld.inverse())
+{
+    // world box around the eight transformed corners of the group's box
+    for (int c = 0; c < 8; ++c) {
+        Vec3 corner((c & 1) ? group->hi[0] : group->lo[0],
+                    (c & 2) ? group->hi[1] : group->lo[1],
+                    (c & 4) ? group->hi[2] : group->lo[2]);
+        Vec3 P = toWorld.point(corner);
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = c == 0 ? P[a] : std::min(lo[a], P[a]);
+            hi[a] = c == 0 ? P[a] : std::max(hi[a], P[a]);
+        }
+    }
+}
+
+// Direction is transformed but not renormalized, so t along the object
+// space ray is the same t as along the world ray and hits compare directly
+// with those of other objects.
+const Intersection
+Instance::intersect(const Ray &ray) const
+{
+    Ray local(toObject.point(ray.E), toObject.vector(ray.D),
+              ray.near, ray.far, ray.bounces, ray.influence);
+    Intersection hit = group->tree->closest(local);
+    if (hit.obj)
+        hit.inst = this;
+    return hit;
+}
+
+const Intersection
+Instance::intersectPrim(const Ray &ray, const Object *obj, int prim) const
+{
+    Ray local(toObject.point(ray.E), toObject.vector(ray.D),
+              ray.near, ray.far, ray.bounces, ray.influence);
+    Intersection hit = obj->intersectPrim(local, prim);
+    if (hit.obj)
+        hit.inst = this;
+    return hit;
+}
+
+// hits report the group's object, so this is only reached through
+// normal(obj, prim, P); fall back to the first object's normal
+const Vec3 Instance::normal(const Vec3 P) const
+{
+    return normal(group->objects.objects.front(), 0, P);
+}
+
+const Vec3 Instance::normal(const Object *obj, int prim, const Vec3 P) const
+{
+    // normals transform by the inverse transpose
+    return normalize(toObject.transposeVector(obj->normal(toObject.point(P), prim)));
+}
+
+void Instance::bounds(Vec3 &_lo, Vec3 &_hi) const
+{
+    _lo = lo;
+    _hi = hi;
+}
+
+size_t Instance::primitives() const
+{
+    return group->objects.objects.size();
+}
+
+Object *Instance::relocate(SceneArena &arena)
+{
+    return arena.make<Instance>(std::move(*this));
+}
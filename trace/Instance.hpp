@@ -0,0 +1,49 @@
+// transformed references to shared groups
+#ifndef INSTANCE_HPP
+#define INSTANCE_HPP
+
+// other classes we use DIRECTLY in the interface
+#include "Object.hpp"
+#include "Transform.hpp"
+#include "Vec3.hpp"
+
+// classes we only use by pointer or reference
+class Group;
+class Ray;
+
+// One placement of a group. Rays are moved into the group's object space
+// and traced through the group's own tree, so every instance of a group
+// shares its geometry and acceleration structure. Hits report the group's
+// primitive as the object and this instance in Intersection::inst.
+class Instance : public Object {
+    const Group *group;     // geometry, already built
+    Transform toWorld;      // object space to world space
+    Transform toObject;     // world space to object space
+
+    // derived, world-space bounds of the transformed group
+    Vec3 lo, hi;
+
+public: // constructors
+    Instance(const Group *_group, const Transform &_toWorld);
+
+public: // object functions
+    const Intersection intersect(const Ray &ray) const override;
+    const Vec3 normal(const Vec3 P) const override;
+    Object *relocate(SceneArena &arena) override;
+    void bounds(Vec3 &_lo, Vec3 &_hi) const override;
+
+public: // instance functions
+    // intersection with part prim of the group's object obj alone
+    const Intersection intersectPrim(const Ray &ray, const Object *obj, int prim) const;
+
+    // world-space normal at world point P on part prim of the group's object obj
+    const Vec3 normal(const Object *obj, int prim, const Vec3 P) const;
+
+    // world point P in the group's object space
+    const Vec3 objectPoint(const Vec3 P) const { return toObject.point(P); }
+
+    // number of primitives in the referenced group
+    size_t primitives() const;
+};
+
+#endif
@@ -9,17 +9,19 @@
 #include "World.hpp"
 
 
-// new intersection with object and intersection location
-Intersection::Intersection(const Object *_obj, float _t) {
+// new intersection with object, part of the object, and intersection location
+Intersection::Intersection(const Object *_obj, Real _t, int _prim) {
     t = _t;
     obj = _obj;
+    inst = 0;
+    prim = _prim;
 }
 
 // return color for one intersection
 const Vec3 
 Intersection::color(const World &w, const Ray &r) const {
     if (obj)
-        return obj->color(w, r, t);
+        return obj->color(w, r, *this);
     else
         // background color
         return w.background;
@@ -8,19 +8,22 @@
 // classes we only use by pointer or reference
 class World;
 class Object;
+class Instance;
 class Ray;
 
 // intersection results: contains object hit and t of first intersection point
 class Intersection {
 public: // public data
-    float t;                // where along ray?
+    Real t;                // where along ray?
 
 public: // private data
     const Object *obj;    // what did we hit?
+    const Instance *inst; // instance obj was reached through, or null
+    int prim;             // which part of obj, for objects with many parts
 
 public: // constructors
     // default construct with no object, intersection at infinity
-    Intersection(const Object *_obj=0, float _t=INFINITY);
+    Intersection(const Object *_obj=0, Real _t=INFINITY, int _prim=0);
 
     // we also also allow default copy constructor and assignment
 
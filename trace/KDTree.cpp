@@ -1,42 +1,196 @@
-
 #include "KDTree.hpp"
 
+#include <algorithm>
+#include <cmath>
+
+// legacy tree node with its own list of objects
+struct KDTree::ListNode {
+	ObjectList* _objects;
+	ListNode* _left;
+	ListNode* _right;
+	int _axis;
+	Real _splitPos;
 
-KDTree::KDTree(ObjectList* objects) {
-	_root = new Node(objects);
+	ListNode(ObjectList* objects)
+		: _objects(objects), _left(nullptr), _right(nullptr), _axis(-1), _splitPos(0) {}
+	~ListNode() { delete _left; delete _right; delete _objects; }
+};
 
-	// splits the tree
-	splitTree(_root);
+// Levels a build over n objects may go down before it makes a leaf, so
+// degenerate input, such as objects at doubling distances that split off
+// one at a time, can't recurse n deep
+static int maxLevels(int n) {
+	return 8 + int(Real(1.3) * std::log2(Real(std::max(n, 1))));
 }
 
-KDTree::~KDTree() {
-	clearTree(_root);
+KDTree::KDTree(const ObjectList* objects, BuildMode mode)
+	: rebuildFactor(2), rebuildMin(8), _deadItems(0), _deadNodes(0) {
+	resetUpdateStats();
+	int n = int(objects->objects.size());
+	if (n == 0) return;
+
+	if (mode == LEGACY) {
+		// splitting moves objects between node lists, so work on a copy of the
+		// pointers and leave the caller's list and its objects untouched
+		ListNode* root = new ListNode(new ObjectList(*objects));
+		splitTree(root, maxLevels(n));
+		nodes.reserve(2 * n + 1);
+		items.reserve(n);
+		flatten(root);
+		delete root;
+		return;
+	}
+
+	nodes.reserve(2 * n + 1);
+	nodes.push_back(KDNode());
+	buildAt(_root, objects->objects);
 }
 
-void KDTree::clearTree(Node* node) {
-	if (node == nullptr) return;
+// build over objs with node as the root, appending objs to items in node order
+void KDTree::buildAt(int node, const std::vector<Object*>& objs) {
+	int n = int(objs.size());
+	int firstNew = int(nodes.size());
+	if (n == 0) {
+		KDNode& k = nodes[node];
+		k._left = k._right = -1;
+		k._first = int(items.size());
+		k._count = 0;
+		k._axis = 0;
+		k._splitPos = 0;
+	}
+
+	// per-object extents, computed once for the whole build
+	std::vector<Vec3> lo(n), hi(n);
+	for (int i = 0; i < n; i++)
+		objs[i]->bounds(lo[i], hi[i]);
+
+	// one index array partitioned in place, with one scratch array for the
+	// partition; every node but the root has a non-empty subtree, so there
+	// are at most 2n+1 nodes
+	std::vector<int> order(n), scratch(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+	int base = int(items.size());
+	if (n > 0)
+		build(node, 0, n, base, maxLevels(n), lo, hi, order, scratch);
+
+	items.resize(base + n);
+	for (int i = 0; i < n; i++)
+		items[base + i] = objs[order[i]];
+
+	// new nodes start with runs exactly full
+	if (!_parent.empty()) {
+		_parent.resize(nodes.size(), -1);
+		_capacity.resize(nodes.size());
+		_built.resize(nodes.size());
+		trackNode(node);
+		for (int nd = firstNew; nd < int(nodes.size()); nd++)
+			trackNode(nd);
+	}
+}
+
+// edit state for a freshly built node
+void KDTree::trackNode(int node) {
+	const KDNode& k = nodes[node];
+	_capacity[node] = _built[node] = k._count;
+	if (k._left >= 0) _parent[k._left] = node;
+	if (k._right >= 0) _parent[k._right] = node;
+	for (int o = k._first; o < k._first + k._count; o++)
+		_nodeOf[items[o]] = node;
+}
+
+// Same split rule as the legacy builder: midpoint of the largest extent,
+// objects entirely on one side move down, straddling objects stay. Each
+// level is a stable three-way partition of the node's range into
+// [straddling | left | right], keeping the legacy order within each group.
+void KDTree::build(int node, int begin, int end, int base, int levels,
+				   const std::vector<Vec3>& lo, const std::vector<Vec3>& hi,
+				   std::vector<int>& order, std::vector<int>& scratch) {
+	if (levels <= 0) {
+		KDNode& n = nodes[node];
+		n._axis = 0;
+		n._splitPos = 0;
+		n._first = base + begin;
+		n._count = end - begin;
+		n._left = n._right = -1;
+		return;
+	}
+
+	// determines split axis and position
+	Vec3 minValue = lo[order[begin]], maxValue = hi[order[begin]];
+	for (int i = begin + 1; i < end; i++) {
+		for (int a = 0; a < 3; a++) {
+			minValue[a] = std::min(minValue[a], lo[order[i]][a]);
+			maxValue[a] = std::max(maxValue[a], hi[order[i]][a]);
+		}
+	}
+	int axis = 0;
+	for (int a = 1; a < 3; a++)
+		if (maxValue[a] - minValue[a] > maxValue[axis] - minValue[axis])
+			axis = a;
+	Real split = Real(0.5) * (minValue[axis] + maxValue[axis]);
+
+	// count each side, then scatter into scratch in group order
+	int leftCount = 0, rightCount = 0;
+	for (int i = begin; i < end; i++) {
+		if (hi[order[i]][axis] < split) ++leftCount;
+		else if (lo[order[i]][axis] > split) ++rightCount;
+	}
+	int stay = end - begin - leftCount - rightCount;
+	int s = begin, l = begin + stay, r = begin + stay + leftCount;
+	for (int i = begin; i < end; i++) {
+		int o = order[i];
+		if (hi[o][axis] < split) scratch[l++] = o;
+		else if (lo[o][axis] > split) scratch[r++] = o;
+		else scratch[s++] = o;
+	}
+	std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+	KDNode& n = nodes[node];
+	n._axis = axis;
+	n._splitPos = split;
+	n._first = base + begin;
+	n._count = stay;
+	n._left = n._right = -1;
 
-	clearTree(node->_left);
-	clearTree(node->_right);
-	delete node;
+	// creates new nodes when necessary
+	if (leftCount > 0) {
+		int child = int(nodes.size());
+		nodes.push_back(KDNode());
+		nodes[node]._left = child;
+		build(child, begin + stay, begin + stay + leftCount, base, levels - 1,
+			  lo, hi, order, scratch);
+	}
+	if (rightCount > 0) {
+		int child = int(nodes.size());
+		nodes.push_back(KDNode());
+		nodes[node]._right = child;
+		build(child, begin + stay + leftCount, end, base, levels - 1,
+			  lo, hi, order, scratch);
+	}
 }
 
-void KDTree::splitTree(Node* node) {
+void KDTree::splitTree(ListNode* node, int levels) {
+	if (levels <= 0) {
+		node->_axis = 0;
+		return;
+	}
+
 	ObjectList* leftList = new ObjectList();
 	ObjectList* rightList = new ObjectList();
-	float min, max = 0;
+	Real min, max = 0;
 
 	// determines split axis and position
 	node->_axis = node->_objects->determineSplitAxis(min, max);
-	node->_splitPos = 0.5f * (min + max);
+	node->_splitPos = Real(0.5) * (min + max);
 
 	// loops through all the objects contained within the node and determines if it needs to be split
 	for (int i = 0; i < node->_objects->size(); i++) {
 		Object* obj = node->_objects->get(i);
-		Vec3 center = obj->getCenter();
-		float radius = obj->getRadius();
-		float minValue = center[node->_axis] - radius;
-		float maxValue = center[node->_axis] + radius;
+		Vec3 lo, hi;
+		obj->bounds(lo, hi);
+		Real minValue = lo[node->_axis];
+		Real maxValue = hi[node->_axis];
 
 		// object lies on the right side of the split
 		if (minValue < node->_splitPos && maxValue < node->_splitPos) {
@@ -51,75 +205,383 @@ void KDTree::splitTree(Node* node) {
 			i--;
 		}
 	}
-	
+
 	// creates new nodes when necessary
 	if (!leftList->empty()) {
-		node->_left = new Node(leftList);
-		splitTree(node->_left);
+		node->_left = new ListNode(leftList);
+		splitTree(node->_left, levels - 1);
 	}
+	else delete leftList;
 	if (!rightList->empty()) {
-		node->_right = new Node(rightList);
-		splitTree(node->_right);
+		node->_right = new ListNode(rightList);
+		splitTree(node->_right, levels - 1);
 	}
+	else delete rightList;
+}
+
+int KDTree::flatten(ListNode* node) {
+	if (node == nullptr) return -1;
+
+	int index = int(nodes.size());
+	nodes.push_back(KDNode());
+	KDNode n;
+	n._axis = node->_axis;
+	n._splitPos = node->_splitPos;
+	n._first = int(items.size());
+	n._count = node->_objects->size();
+	items.insert(items.end(), node->_objects->objects.begin(), node->_objects->objects.end());
+	n._left = flatten(node->_left);
+	n._right = flatten(node->_right);
+	nodes[index] = n;
+	return index;
 }
 
 void KDTree::printTree() {
-	printTreeRec(_root);
+	if (!nodes.empty()) printTreeRec(_root);
 }
 
-void KDTree::printTreeRec(Node* node) {
-	if (node == nullptr) return;
+void KDTree::printTreeRec(int node) {
+	if (node < 0) return;
 
-	std::cout << node->_axis << " : " << node->_splitPos << " : " << node->_objects->size() << std::endl;
-	printTreeRec(node->_left);
-	printTreeRec(node->_right);
+	const KDNode& n = nodes[node];
+	std::cout << n._axis << " : " << n._splitPos << " : " << n._count << std::endl;
+	printTreeRec(n._left);
+	printTreeRec(n._right);
 }
 
 int KDTree::countObjects() {
-	return countObjectsRec(_root);
+	return nodes.empty() ? 0 : countObjectsRec(_root);
 }
 
-int KDTree::countObjectsRec(Node* node) {
-	if (node == nullptr) return 0;
+int KDTree::countObjectsRec(int node) {
+	if (node < 0) return 0;
 
 	int count = 0;
-	count += node->_objects->size();
-	count += countObjectsRec(node->_left) + countObjectsRec(node->_right);
+	count += nodes[node]._count;
+	count += countObjectsRec(nodes[node]._left) + countObjectsRec(nodes[node]._right);
 
 	return count;
 }
 
-float KDTree::planeIntersect(Ray r, Node* node) {
-	// solves for the value t that intersects with the splitting plane
-	float t = float((node->_splitPos - r.E[node->_axis])) / float(r.D[node->_axis]);
-	return t;
+Intersection KDTree::trace(const Ray &r) const {
+	++RayCounts::current->rays;
+	return closest(r);
+}
+
+// Each node's objects lie in its cell, the part of space its ancestors'
+// planes cut out, which the ray crosses over [tmin, tmax]. The ray meets
+// the node's plane at t, found with the ray's 1/D; the child on the side
+// the ray comes from, picked by the sign of D, covers [tmin, t] and the
+// other [t, tmax]. Axis-parallel rays get an infinite t, so one child gets
+// the whole interval and the other none. A ray lying in the plane gets a
+// NaN t, which the min and max below pass over, so both children get the
+// whole interval. Far children wait on a stack, clipped to the closest
+// hit when they come off it.
+namespace {
+	struct KDStackEntry {
+		int node;
+		Real tmin, tmax;
+	};
+	const int KDStackSize = 64;
+}
+
+Intersection KDTree::closest(const Ray &r) const {
+	Intersection closest;
+	if (!nodes.empty()) {
+		Ray ray = r;
+		closestIn(_root, r.near, r.far, ray, closest);
+	}
+	return closest;
+}
+
+void KDTree::closestIn(int node, Real tmin, Real tmax, Ray &r, Intersection &closest) const {
+	KDStackEntry stack[KDStackSize];
+	int top = 0;
+	for (;;) {
+		const KDNode& n = nodes[node];
+		for (int o = n._first; o < n._first + n._count; o++) {
+			Intersection current = items[o]->intersect(r);
+			if (r.near < current.t && current.t < r.far) {
+				r.far = current.t;
+				closest = current;
+			}
+		}
+
+		int axis = n._axis, side = r.sign[axis];
+		Real t = (n._splitPos - r.E[axis]) * r.invD[axis];
+		int nearChild = side ? n._right : n._left;
+		int farChild = side ? n._left : n._right;
+		Real nearMax = std::min(tmax, t), farMin = std::max(tmin, t);
+
+		if (farChild >= 0 && farMin <= tmax) {
+			if (top < KDStackSize) {
+				KDStackEntry far = { farChild, farMin, tmax };
+				stack[top++] = far;
+			}
+			else
+				closestIn(farChild, farMin, tmax, r, closest);  // very deep trees only
+		}
+		if (nearChild >= 0 && tmin <= nearMax) {
+			node = nearChild;
+			tmax = nearMax;
+			continue;
+		}
+
+		// next waiting far child still nearer than the closest hit
+		for (node = -1; top > 0 && node < 0; ) {
+			const KDStackEntry &e = stack[--top];
+			if (e.tmin <= std::min(e.tmax, r.far)) {
+				node = e.node;
+				tmin = e.tmin;
+				tmax = std::min(e.tmax, r.far);
+			}
+		}
+		if (node < 0)
+			return;
+	}
+}
+
+size_t KDTree::bytes() const {
+	return nodes.capacity() * sizeof(KDNode) + items.capacity() * sizeof(Object*);
+}
+
+bool KDTree::probe(const Ray &r) const {
+	++RayCounts::current->shadows;
+	return any(r);
 }
 
-void KDTree::traverse(Intersection& intersect, Node* node, Ray r, Vec3 p) {
-	if (node == nullptr) return;
+bool KDTree::any(const Ray &r) const {
+	return !nodes.empty() && anyIn(_root, r.near, r.far, r);
+}
+
+// same visiting order as closestIn, stopping at the first hit
+bool KDTree::anyIn(int node, Real tmin, Real tmax, const Ray &r) const {
+	KDStackEntry stack[KDStackSize];
+	int top = 0;
+	for (;;) {
+		const KDNode& n = nodes[node];
+		for (int o = n._first; o < n._first + n._count; o++)
+			if (items[o]->intersect(r).t < r.far)
+				return true;
 
-	Intersection i = node->_objects->trace(r);
+		int axis = n._axis, side = r.sign[axis];
+		Real t = (n._splitPos - r.E[axis]) * r.invD[axis];
+		int nearChild = side ? n._right : n._left;
+		int farChild = side ? n._left : n._right;
+		Real nearMax = std::min(tmax, t), farMin = std::max(tmin, t);
 
-	if (r.near < i.t && i.t < r.far) {
-		r.far = i.t;
-		intersect = i;
+		if (farChild >= 0 && farMin <= tmax) {
+			if (top < KDStackSize) {
+				KDStackEntry far = { farChild, farMin, tmax };
+				stack[top++] = far;
+			}
+			else if (anyIn(farChild, farMin, tmax, r))
+				return true;
+		}
+		if (nearChild >= 0 && tmin <= nearMax) {
+			node = nearChild;
+			tmax = nearMax;
+			continue;
+		}
+		if (top == 0)
+			return false;
+		const KDStackEntry &e = stack[--top];
+		node = e.node;
+		tmin = e.tmin;
+		tmax = e.tmax;
 	}
+}
 
-	if (p[node->_axis] < node->_splitPos) {
-		traverse(intersect, node->_left, r, p);
-		float t = 0;
-		t = planeIntersect(r, node);
+void KDTree::resetUpdateStats() {
+	updateStats.edits = updateStats.relocated = 0;
+	updateStats.rebuilds = updateStats.rebuiltObjects = 0;
+}
 
-		if (r.near < t && t < r.far) {
-			traverse(intersect, node->_right, r, r.E + t * r.D);
+// per-node edit state is only needed once the tree is edited
+void KDTree::makeDynamic() {
+	if (!_parent.empty() || nodes.empty()) return;
+
+	_parent.assign(nodes.size(), -1);
+	_capacity.resize(nodes.size());
+	_built.resize(nodes.size());
+	for (int nd = 0; nd < int(nodes.size()); nd++)
+		trackNode(nd);
+}
+
+// Walk down from the root the way the builder would place an object with
+// these bounds. Returns stop if it lies on that path (the object may stay
+// where it is), else the node the object belongs in, making a new leaf
+// if the path runs off the tree.
+int KDTree::descend(const Vec3 &lo, const Vec3 &hi, int stop) {
+	if (nodes.empty()) {
+		nodes.push_back(KDNode());
+		nodes[0]._left = nodes[0]._right = -1;
+		nodes[0]._count = 0;
+		nodes[0]._first = int(items.size());
+		_parent.assign(1, -1);
+		_capacity.assign(1, 0);
+		_built.assign(1, 0);
+	}
+	else makeDynamic();
+
+	int node = _root;
+	for (;;) {
+		if (node == stop) return stop;
+
+		KDNode& n = nodes[node];
+		int* child;
+		if (n._count == 0 && n._left < 0 && n._right < 0) return node;  // empty leaf
+		if (hi[n._axis] < n._splitPos) child = &n._left;
+		else if (lo[n._axis] > n._splitPos) child = &n._right;
+		else return node;
+
+		if (*child >= 0) {
+			node = *child;
+			continue;
 		}
+
+		// new leaf, split through the middle of its first object like the builder
+		int leaf = int(nodes.size());
+		*child = leaf;
+		KDNode k;
+		k._left = k._right = -1;
+		k._first = int(items.size());
+		k._count = 0;
+		k._axis = 0;
+		for (int a = 1; a < 3; a++)
+			if (hi[a] - lo[a] > hi[k._axis] - lo[k._axis])
+				k._axis = a;
+		k._splitPos = Real(0.5) * (lo[k._axis] + hi[k._axis]);
+		nodes.push_back(k);
+		_parent.push_back(node);
+		_capacity.push_back(0);
+		_built.push_back(0);
+		return leaf;
+	}
+}
+
+// append to a node's run, moving the run to the end of items if it is full
+void KDTree::insertAt(int node, Object* obj) {
+	KDNode& n = nodes[node];
+	if (n._count == _capacity[node]) {
+		int capacity = std::max(4, 2 * _capacity[node]);
+		int first = int(items.size());
+		items.resize(first + capacity);
+		std::copy(items.begin() + n._first, items.begin() + n._first + n._count,
+				  items.begin() + first);
+		_deadItems += _capacity[node];
+		n._first = first;
+		_capacity[node] = capacity;
 	}
-	else {
-		traverse(intersect, node->_right, r, p);
-		float t = 0;
-		t = planeIntersect(r, node);
-		if (r.near < t && t < r.far) {
-			traverse(intersect, node->_left, r, r.E + t * r.D);
+	items[n._first + n._count++] = obj;
+	_nodeOf[obj] = node;
+
+	// too many objects piled up here since the node was built
+	if (n._count > std::max(rebuildMin, int(rebuildFactor * _built[node])))
+		rebuildSubtree(node);
+}
+
+// swap with the last object of the run and shrink it
+void KDTree::removeAt(int node, Object* obj) {
+	KDNode& n = nodes[node];
+	for (int o = n._first; o < n._first + n._count; o++) {
+		if (items[o] == obj) {
+			items[o] = items[n._first + --n._count];
+			return;
 		}
 	}
-}
\ No newline at end of file
+}
+
+void KDTree::insert(Object* obj) {
+	++updateStats.edits;
+	Vec3 lo, hi;
+	obj->bounds(lo, hi);
+	int node = descend(lo, hi, -1);
+	insertAt(node, obj);
+}
+
+void KDTree::remove(Object* obj) {
+	++updateStats.edits;
+	makeDynamic();
+	auto found = _nodeOf.find(obj);
+	if (found == _nodeOf.end()) return;
+	removeAt(found->second, obj);
+	_nodeOf.erase(found);
+}
+
+// objects only move when they leave their node's region; otherwise the
+// split planes are still valid and nothing changes
+void KDTree::update(Object* obj) {
+	++updateStats.edits;
+	makeDynamic();
+	auto found = _nodeOf.find(obj);
+	if (found == _nodeOf.end()) {
+		--updateStats.edits;
+		insert(obj);
+		return;
+	}
+
+	int current = found->second;
+	Vec3 lo, hi;
+	obj->bounds(lo, hi);
+	int node = descend(lo, hi, current);
+	if (node == current) return;
+
+	++updateStats.relocated;
+	removeAt(current, obj);
+	insertAt(node, obj);
+}
+
+// every object in the subtree at node; their runs become dead space
+void KDTree::collect(int node, std::vector<Object*>& objs) {
+	std::vector<int> stack(1, node);
+	while (!stack.empty()) {
+		int nd = stack.back();
+		stack.pop_back();
+		const KDNode& k = nodes[nd];
+		objs.insert(objs.end(), items.begin() + k._first, items.begin() + k._first + k._count);
+		_deadItems += _capacity[nd];
+		++_deadNodes;
+		if (k._left >= 0) stack.push_back(k._left);
+		if (k._right >= 0) stack.push_back(k._right);
+	}
+}
+
+// rebuild the subtree at node with the in-place builder; the new nodes and
+// runs go at the end of the arrays and the old ones are left as dead space
+// until more than half of either array is dead, then the whole tree is
+// rebuilt compactly
+void KDTree::rebuildSubtree(int node) {
+	std::vector<Object*> objs;
+	collect(node, objs);
+	++updateStats.rebuilds;
+	updateStats.rebuiltObjects += int(objs.size());
+
+	if (node != _root && 2 * _deadItems < items.size() && 2 * _deadNodes < nodes.size()) {
+		int rebuilt = int(nodes.size());
+		nodes.push_back(KDNode());
+		buildAt(rebuilt, objs);
+
+		int parent = _parent[node];
+		if (nodes[parent]._left == node) nodes[parent]._left = rebuilt;
+		else nodes[parent]._right = rebuilt;
+		_parent[rebuilt] = parent;
+		return;
+	}
+
+	// compact: rebuild everything that is still in the tree
+	if (node != _root) {
+		objs.clear();
+		collect(_root, objs);
+		updateStats.rebuiltObjects += int(objs.size());
+	}
+	nodes.clear();
+	items.clear();
+	_nodeOf.clear();
+	_deadItems = _deadNodes = 0;
+	_parent.assign(1, -1);
+	_capacity.assign(1, 0);
+	_built.assign(1, 0);
+	nodes.push_back(KDNode());
+	buildAt(_root, objs);
+}
@@ -1,6 +1,7 @@
 #ifndef KDTREE_HPP
 #define KDTREE_HPP
 
+#include "Accel.hpp"
 #include "Vec3.hpp"
 #include "Object.hpp"
 #include "ObjectList.hpp"
@@ -8,46 +9,117 @@
 
 #include <vector>
 #include <iostream>
+#include <unordered_map>
 
-class Node {
-public:
-    friend class KDTree;
-
-    Node(ObjectList* objects) {
-        _objects = objects;
-        _left = nullptr;
-        _right = nullptr;
-        _axis = -1;
-        _splitPos = 0;
-    }
-
-public:
-    ObjectList* _objects;
-    Node* _left;    // objects to the left of the splitting plane
-    Node* _right;   // objects to the right of the splitting plane
+// one tree node, stored by index in KDTree::nodes
+// objects that straddle the split stay in the node; leaves have no split
+struct KDNode {
+    int _left;      // node index for objects to the left of the splitting plane, -1 if none
+    int _right;     // node index for objects to the right of the splitting plane, -1 if none
+    int _first;     // first of this node's objects in KDTree::items
+    int _count;     // number of this node's objects
     int _axis;      // 0 = x, 1 = y, 2 = z
-    float _splitPos;
+    Real _splitPos;
 };
 
 
-class KDTree {
+class KDTree : public Accel {
 public:
-     KDTree(ObjectList* objects);
-    ~KDTree();
+    enum BuildMode {
+        IN_PLACE,   // partition one index array in place, O(n log n)
+        LEGACY      // original per-node ObjectList splitting, O(n^2) per node
+    };
 
-    void splitTree(Node* node);     // recursively splits the tree
+     KDTree(const ObjectList* objects, BuildMode mode = IN_PLACE);
 
     void printTree();               // prints the elements of the tree
-    void printTreeRec(Node* node);  // recursive helper
+    void printTreeRec(int node);    // recursive helper
     int countObjects();             // returns the number of objects in the tree
-    int countObjectsRec(Node* node);// recursive helper
-    void clearTree(Node* node);     // deletes tree nodes
-    
-    float planeIntersect(Ray r, Node* node);    // intersection point of ray and plane
-    void traverse(Intersection& intersect, Node* node, Ray r, Vec3 p);  // traverses the tree to find the closest object
+    int countObjectsRec(int node);  // recursive helper
+
+
+    // closest intersection along r
+    Intersection trace(const Ray &r) const override;
+
+    // true if anything is hit between r.near and r.far
+    bool probe(const Ray &r) const override;
+
+    // bytes in nodes and items
+    size_t bytes() const override;
+
+    // copy of the nodes and items, sharing the objects
+    Accel *clone() const override { return new KDTree(*this); }
+
+    // trace and probe without adding to the ray counts, for rays that are
+    // already counted, such as rays moved into an instance's object space
+    Intersection closest(const Ray &r) const;
+    bool any(const Ray &r) const;
+
+private: // traversal
+    // closest hit in node's subtree, which r crosses over [tmin, tmax],
+    // lowering r.far to each hit found; and whether anything is hit there
+    void closestIn(int node, Real tmin, Real tmax, Ray &r, Intersection &closest) const;
+    bool anyIn(int node, Real tmin, Real tmax, const Ray &r) const;
+
+public: // dynamic updates
+    // Edits cost O(depth) plus the objects in any subtree that gets rebuilt.
+    // Call update after moving or resizing an object already in the tree.
+    // Objects are not owned; remove before destroying one.
+    void insert(Object* obj);
+    void remove(Object* obj);
+    void update(Object* obj);
+
+    // rebuild a subtree once a node holds more than rebuildFactor times the
+    // objects it was built with (and at least rebuildMin)
+    Real rebuildFactor;
+    int rebuildMin;
+
+    // work done by edits since the last resetUpdateStats
+    struct UpdateStats {
+        int edits;              // insert, remove and update calls
+        int relocated;          // objects that had to change node
+        int rebuilds;           // local subtree rebuilds
+        int rebuiltObjects;     // objects re-partitioned by those rebuilds
+    } updateStats;
+    void resetUpdateStats();
+
+private:
+    // in-place builder: partitions order[begin,end) for node and its subtree,
+    // whose objects go to items starting at base; node becomes a leaf of
+    // all its objects once levels run out
+    void build(int node, int begin, int end, int base, int levels,
+               const std::vector<Vec3> &lo, const std::vector<Vec3> &hi,
+               std::vector<int> &order, std::vector<int> &scratch);
+
+    // build a tree over objs with its root at node and items appended
+    void buildAt(int node, const std::vector<Object*> &objs);
+
+    // dynamic update helpers
+    void makeDynamic();                         // set up per-node edit state
+    void trackNode(int node);                   // edit state for one node
+    int descend(const Vec3 &lo, const Vec3 &hi, int stop); // node for bounds
+    void insertAt(int node, Object* obj);       // append to a node's run
+    void removeAt(int node, Object* obj);       // swap-remove from a run
+    void rebuildSubtree(int node);              // local rebuild
+    void collect(int node, std::vector<Object*> &objs); // subtree objects
+
+    // legacy builder on per-node object lists, flattened into nodes and items
+    struct ListNode;
+    void splitTree(ListNode* node, int levels); // recursively splits the tree
+    int flatten(ListNode* node);        // copies a list node subtree into nodes
 
 public:
-    Node* _root;
+    static const int _root = 0;     // root node index
+    std::vector<KDNode> nodes;      // all nodes, root first
+    std::vector<Object*> items;     // node objects, each node's run contiguous
+
+private: // dynamic update state, empty until the first edit
+    std::vector<int> _parent;       // parent node index, -1 for the root
+    std::vector<int> _capacity;     // slots reserved in items for each run
+    std::vector<int> _built;        // run size when each node was built
+    std::unordered_map<const Object*, int> _nodeOf;  // node holding each object
+    size_t _deadItems;              // items slots no longer used by any run
+    size_t _deadNodes;              // nodes cut off by subtree rebuilds
 };
 
-#endif
\ No newline at end of file
+#endif
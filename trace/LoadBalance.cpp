@@ -0,0 +1,188 @@
+// implementation code for LoadBalance class
+// worker and tile timing summaries and the tile cost map
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "LoadBalance.hpp"
+
+// system includes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+
+LoadBalance::LoadBalance(int _tileSize)
+    : tileSize(std::max(1, _tileSize)), tilesX(0), tilesY(0), regionX1(0), regionY1(0),
+      wall(0), critical(0), tail(0), renders(0),
+      added(0), renderBusy(0), longestTile(0), firstDone(0), lastDone(0)
+{
+}
+
+void LoadBalance::begin(int /*x0*/, int /*y0*/, int x1, int y1)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    regionX1 = x1;
+    regionY1 = y1;
+
+    // grow the map to reach the region, keeping what is there in place
+    int wantX = std::max(tilesX, (x1 + tileSize - 1) / tileSize);
+    int wantY = std::max(tilesY, (y1 + tileSize - 1) / tileSize);
+    if (wantX == tilesX && wantY == tilesY)
+        return;
+    std::vector<double> grown(size_t(wantX) * wantY, 0);
+    for (int ty = 0; ty < tilesY; ++ty)
+        std::copy(map.begin() + size_t(ty) * tilesX, map.begin() + size_t(ty + 1) * tilesX,
+                  grown.begin() + size_t(ty) * wantX);
+    map.swap(grown);
+    tilesX = wantX;
+    tilesY = wantY;
+}
+
+void LoadBalance::add(int worker, const Worker &tiles)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (renderWorkerBusy.size() <= size_t(worker))
+        renderWorkerBusy.resize(worker + 1, 0);
+    renderWorkerBusy[worker] += tiles.busy;
+    renderBusy += tiles.busy;
+
+    firstDone = added++ ? std::min(firstDone, tiles.finished) : tiles.finished;
+    lastDone = std::max(lastDone, tiles.finished);
+
+    for (size_t t = 0; t < tiles.seconds.size(); ++t) {
+        // the tile's pixels, clipped to the region, spread over the cells
+        int x0 = tiles.x[t], x1 = std::min(x0 + tileSize, regionX1);
+        int y0 = tiles.y[t], y1 = std::min(y0 + tileSize, regionY1);
+        double perPixel = tiles.seconds[t] / std::max(1.0, double(x1 - x0) * (y1 - y0));
+        for (int ty = y0 / tileSize; ty * tileSize < y1 && ty < tilesY; ++ty) {
+            int h = std::min(y1, (ty + 1) * tileSize) - std::max(y0, ty * tileSize);
+            for (int tx = x0 / tileSize; tx * tileSize < x1 && tx < tilesX; ++tx) {
+                int w = std::min(x1, (tx + 1) * tileSize) - std::max(x0, tx * tileSize);
+                map[size_t(ty) * tilesX + tx] += perPixel * w * h;
+            }
+        }
+        tileSeconds.push_back(tiles.seconds[t]);
+        longestTile = std::max(longestTile, double(tiles.seconds[t]));
+    }
+}
+
+void LoadBalance::finish(int workers, double seconds)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    workers = std::max(workers, 1);
+    if (busy.size() < size_t(workers)) {
+        busy.resize(workers, 0);
+        idle.resize(workers, 0);
+    }
+    renderWorkerBusy.resize(std::max(renderWorkerBusy.size(), size_t(workers)), 0);
+    for (int w = 0; w < workers; ++w) {
+        busy[w] += renderWorkerBusy[w];
+        idle[w] += std::max(0.0, seconds - renderWorkerBusy[w]);
+    }
+    wall += seconds;
+    critical += std::max(renderBusy / workers, longestTile);
+    tail += lastDone - firstDone;
+    ++renders;
+
+    added = 0;
+    renderBusy = longestTile = firstDone = lastDone = 0;
+    renderWorkerBusy.clear();
+}
+
+// nearest-rank percentile of sorted costs
+static double percentile(const std::vector<float> &sorted, double p)
+{
+    size_t rank = size_t(p * sorted.size() + 0.999999);
+    return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+void LoadBalance::print(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (renders == 0 || tileSeconds.empty())
+        return;
+
+    double busyTotal = 0, idleTotal = 0;
+    for (size_t w = 0; w < busy.size(); ++w) {
+        busyTotal += busy[w];
+        idleTotal += idle[w];
+    }
+    out << "load balance: " << busy.size() << " worker" << (busy.size() == 1 ? "" : "s")
+        << " over " << renders << " render" << (renders == 1 ? "" : "s") << ", "
+        << wall << " s wall\n"
+        << "  busy " << *std::min_element(busy.begin(), busy.end()) << '-'
+        << *std::max_element(busy.begin(), busy.end()) << " s per worker, idle "
+        << 100 * idleTotal / std::max(busyTotal + idleTotal, 1e-9) << "% of worker time\n"
+        << "  " << tail << " s from the first worker finishing to the last\n"
+        << "  critical path estimate " << critical << " s, wall is "
+        << wall / std::max(critical, 1e-9) << "x that\n";
+
+    std::vector<float> sorted(tileSeconds);
+    std::sort(sorted.begin(), sorted.end());
+    out << "tile cost: p50 " << 1000 * percentile(sorted, 0.5)
+        << " ms, p90 " << 1000 * percentile(sorted, 0.9)
+        << " ms, p99 " << 1000 * percentile(sorted, 0.99)
+        << " ms, max " << 1000 * sorted.back() << " ms over "
+        << sorted.size() << " tiles\n";
+}
+
+// blocks of tiles summed, each block one character; characters are about
+// twice as tall as wide, so blocks are too
+void LoadBalance::printMap(std::ostream &out, int columns) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (map.empty())
+        return;
+    int fx = std::max(1, (tilesX + columns - 1) / columns), fy = 2 * fx;
+    int mapX = (tilesX + fx - 1) / fx, mapY = (tilesY + fy - 1) / fy;
+    std::vector<double> blocks(size_t(mapX) * mapY, 0);
+    for (int ty = 0; ty < tilesY; ++ty)
+        for (int tx = 0; tx < tilesX; ++tx)
+            blocks[size_t(ty / fy) * mapX + tx / fx] += map[size_t(ty) * tilesX + tx];
+    double top = *std::max_element(blocks.begin(), blocks.end());
+
+    static const char shades[] = " .:-=+*#%@";
+    int levels = int(strlen(shades));
+    out << "tile cost map (" << fx << 'x' << fy << " tiles per character, @ = "
+        << 1000 * top << " ms):\n";
+    for (int y = 0; y < mapY; ++y) {
+        out << "  ";
+        for (int x = 0; x < mapX; ++x) {
+            double c = top > 0 ? blocks[size_t(y) * mapX + x] / top : 0;
+            out << shades[std::min(levels - 1, int(c * levels))];
+        }
+        out << '\n';
+    }
+}
+
+bool LoadBalance::writeMap(const char *filename) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t length = strlen(filename);
+    bool json = length >= 5 && strcmp(filename + length - 5, ".json") == 0;
+    std::ofstream output(filename, std::ofstream::out | std::ofstream::binary);
+
+    if (json) {
+        output << "{\"tileSize\":" << tileSize << ",\"tilesX\":" << tilesX
+            << ",\"tilesY\":" << tilesY << ",\"seconds\":[";
+        for (int ty = 0; ty < tilesY; ++ty) {
+            output << (ty ? ",\n[" : "\n[");
+            for (int tx = 0; tx < tilesX; ++tx)
+                output << (tx ? "," : "") << map[size_t(ty) * tilesX + tx];
+            output << ']';
+        }
+        output << "]}\n";
+    }
+    else {
+        double top = map.empty() ? 0 : *std::max_element(map.begin(), map.end());
+        output << "P5\n" << tilesX << ' ' << tilesY << "\n255\n";
+        for (double c : map)
+            output.put(char(top > 0 ? int(255 * c / top + 0.5) : 0));
+    }
+
+    if (!output) {
+        std::cerr << "Error writing " << filename << '\n';
+        return false;
+    }
+    return true;
+}
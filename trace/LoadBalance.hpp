@@ -0,0 +1,72 @@
+// how evenly render work spread over the worker threads
+#ifndef LOADBALANCE_HPP
+#define LOADBALANCE_HPP
+
+// system includes necessary for the interface
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Time each worker spent on tiles and waiting, the cost of every tile, and
+// a map of cost over the image, summed over all renders it is given. The
+// map is in tileSize cells from the image corner and grows to cover every
+// region rendered; a tile that straddles cells, as in a crop that doesn't
+// start on a cell edge, is split between them by area.
+//
+// Each render's critical path is estimated as the longer of its work
+// spread perfectly over the workers and its most expensive tile, which no
+// schedule can split; wall time over that shows what scheduling and tile
+// size lose.
+class LoadBalance {
+public: // constructors
+    // for images rendered in tileSize tiles
+    explicit LoadBalance(int tileSize);
+
+public: // recording, from the renderer
+    // a render of pixels [x0,x1) x [y0,y1) is starting
+    void begin(int x0, int y0, int x1, int y1);
+
+    // one worker's tiles in a render
+    struct Worker {
+        double busy;                // seconds spent in tiles
+        double finished;            // seconds from the start of the render
+        std::vector<int> x, y;      // tile corners, in pixels
+        std::vector<float> seconds; // and their costs
+    };
+
+    // a worker is done; safe to call from any thread
+    void add(int worker, const Worker &tiles);
+
+    // the render's workers are all done after wall seconds
+    void finish(int workers, double wall);
+
+public: // results
+    // worker busy and idle time, tile cost percentiles, critical path
+    void print(std::ostream &out) const;
+
+    // the cost map as characters, coarsened to at most columns wide
+    void printMap(std::ostream &out, int columns = 64) const;
+
+    // write the cost map to filename: JSON if it ends in .json, else a
+    // binary PGM scaled to the most expensive tile; false if it can't
+    bool writeMap(const char *filename) const;
+
+private:
+    int tileSize, tilesX, tilesY;
+    std::vector<double> map;            // seconds per tile of the image
+    int regionX1, regionY1;             // far corner of this render's region
+
+    std::vector<double> busy, idle;     // per worker, over all renders
+    std::vector<float> tileSeconds;     // every tile of every render
+    double wall, critical, tail;        // summed over renders
+    int renders;
+
+    // this render so far
+    int added;                          // workers done
+    double renderBusy, longestTile, firstDone, lastDone;
+    std::vector<double> renderWorkerBusy;
+
+    mutable std::mutex lock;
+};
+
+#endif
@@ -0,0 +1,219 @@
+// implementation code for Mesh object class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Mesh.hpp"
+
+// other classes used directly in the implementation
+#include "SceneArena.hpp"
+#include "Ray.hpp"
+#include "Intersection.hpp"
+#include "Profile.hpp"
+
+// system includes
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// vertex index from an OBJ face entry (v, v/vt, v//vn or v/vt/vn),
+// 1-based or negative from the end; -1 if it is out of range
+static long objIndex(const char *entry, long vertexCount)
+{
+    long v = strtol(entry, 0, 10);
+    if (v < 0) v += vertexCount;
+    else --v;
+    return v >= 0 && v < vertexCount ? v : -1;
+}
+
+bool
+Mesh::load(const char *filename, bool compressed)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) return false;
+
+    // read lines from file, ignoring everything but 'v' and 'f' lines
+    char line[4096];
+    std::vector<long> face;
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == 'v' && line[1] == ' ') {
+            float x, y, z;
+            if (sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3) {
+                vertices.push_back(x);
+                vertices.push_back(y);
+                vertices.push_back(z);
+            }
+        }
+        else if (line[0] == 'f' && line[1] == ' ') {
+            // every whitespace-separated entry is one corner
+            face.clear();
+            long vertexCount = long(vertices.size() / 3);
+            for (char *c = line + 2; *c; ) {
+                while (*c == ' ' || *c == '\t') ++c;
+                if (*c == '\0' || *c == '\n' || *c == '\r') break;
+                face.push_back(objIndex(c, vertexCount));
+                while (*c && *c != ' ' && *c != '\t' && *c != '\n') ++c;
+            }
+
+            // fan triangulation, skipping faces with bad indices
+            if (std::find(face.begin(), face.end(), -1L) != face.end()) continue;
+            for (size_t i = 2; i < face.size(); ++i) {
+                indices.push_back(uint32_t(face[0]));
+                indices.push_back(uint32_t(face[i-1]));
+                indices.push_back(uint32_t(face[i]));
+            }
+        }
+    }
+    fclose(fp);
+
+    build(compressed);
+    return true;
+}
+
+void
+Mesh::build(bool compressed)
+{
+    PROFILE_SCOPE("mesh build");
+    size_t count = triangleCount();
+
+    // triangle boxes for the BVH
+    std::vector<BVHBox> boxes(count);
+    for (size_t i = 0; i < count; ++i) {
+        BVHBox &box = boxes[i];
+        const float *v = &vertices[3 * indices[3*i]];
+        for (int a = 0; a < 3; ++a)
+            box.lo[a] = box.hi[a] = v[a];
+        for (int k = 1; k < 3; ++k) {
+            v = &vertices[3 * indices[3*i + k]];
+            for (int a = 0; a < 3; ++a) {
+                box.lo[a] = std::min(box.lo[a], v[a]);
+                box.hi[a] = std::max(box.hi[a], v[a]);
+            }
+        }
+    }
+    bvh.build(boxes);
+    std::vector<BVHBox>().swap(boxes);
+
+    // put indices in slot order, so triangle number == slot, and derive
+    // the intersection data in the same order
+    std::vector<uint32_t> sorted(indices.size());
+    triangles.resize(count);
+    for (size_t s = 0; s < count; ++s) {
+        size_t i = size_t(bvh.order[s]);
+        for (int k = 0; k < 3; ++k)
+            sorted[3*s + k] = indices[3*i + k];
+
+        const float *v0 = &vertices[3 * sorted[3*s]];
+        const float *v1 = &vertices[3 * sorted[3*s + 1]];
+        const float *v2 = &vertices[3 * sorted[3*s + 2]];
+        Triangle &tri = triangles[s];
+        for (int a = 0; a < 3; ++a) {
+            tri.v0[a] = v0[a];
+            tri.e1[a] = v1[a] - v0[a];
+            tri.e2[a] = v2[a] - v0[a];
+        }
+    }
+    indices.swap(sorted);
+    vertices.shrink_to_fit();
+    std::vector<int>().swap(bvh.order);
+
+    bvh.bounds(lo, hi);
+    if (compressed) {
+        if (qbvh.build(bvh, [](int first, int) { return uint32_t(first); }))
+            std::vector<BVHNode>().swap(bvh.nodes);
+        else
+            std::cerr << "Mesh: " << count << " triangles, past "
+                      << (QBVH::PayloadMask + 1) << ", using the uncompressed BVH\n";
+    }
+}
+
+// Moller-Trumbore ray/triangle test on the compact triangles
+inline bool
+Mesh::hitTriangle(const Ray &ray, int s, Real far, Real &t) const
+{
+    const Triangle &tri = triangles[s];
+    Vec3 e1(tri.e1[0], tri.e1[1], tri.e1[2]);
+    Vec3 e2(tri.e2[0], tri.e2[1], tri.e2[2]);
+
+    Vec3 p = cross(ray.D, e2);
+    Real det = dot(e1, p);
+    if (det == 0) return false;         // ray parallel to triangle
+    Real inv = 1 / det;
+
+    Vec3 d = ray.E - Vec3(tri.v0[0], tri.v0[1], tri.v0[2]);
+    Real u = dot(d, p) * inv;
+    if (u < 0 || u > 1) return false;
+
+    Vec3 q = cross(d, e1);
+    Real v = dot(ray.D, q) * inv;
+    if (v < 0 || u + v > 1) return false;
+
+    t = dot(e2, q) * inv;
+    return t > ray.near && t < far;
+}
+
+const Intersection
+Mesh::intersect(const Ray &ray) const
+{
+    int hitPrim = -1;
+    Real hitT = ray.far;
+
+    auto leaf = [&](int first, int count, Real &far) {
+        Real t;
+        for (int s = first; s < first + count; ++s)
+            if (hitTriangle(ray, s, far, t)) {
+                far = t;
+                hitPrim = s;
+            }
+    };
+    if (qbvh.nodes.empty())
+        bvh.closest(ray, hitT, leaf);
+    else
+        qbvh.closest(ray, hitT, leaf);
+
+    if (hitPrim < 0) return Intersection();
+    return Intersection(this, hitT, hitPrim);
+}
+
+const Intersection
+Mesh::intersectPrim(const Ray &ray, int prim) const
+{
+    Real t;
+    if (!hitTriangle(ray, prim, ray.far, t)) return Intersection();
+    return Intersection(this, t, prim);
+}
+
+// hits always carry a triangle, so this is only a fallback
+const Vec3 Mesh::normal(const Vec3 P) const
+{
+    return normal(P, 0);
+}
+
+// face normal, wound like the OBJ face
+const Vec3 Mesh::normal(const Vec3 /*P*/, int prim) const
+{
+    const Triangle &tri = triangles[prim];
+    return normalize(cross(Vec3(tri.e1[0], tri.e1[1], tri.e1[2]),
+                           Vec3(tri.e2[0], tri.e2[1], tri.e2[2])));
+}
+
+void Mesh::bounds(Vec3 &_lo, Vec3 &_hi) const
+{
+    _lo = lo;
+    _hi = hi;
+}
+
+size_t Mesh::bytes() const
+{
+    return vertices.capacity() * sizeof(float)
+        + indices.capacity() * sizeof(uint32_t)
+        + triangles.capacity() * sizeof(Triangle)
+        + bvh.nodes.capacity() * sizeof(BVHNode)
+        + qbvh.bytes();
+}
+
+Object *Mesh::relocate(SceneArena &arena)
+{
+    return arena.make<Mesh>(std::move(*this));
+}
@@ -0,0 +1,71 @@
+// triangle mesh objects
+#ifndef MESH_HPP
+#define MESH_HPP
+
+// other classes we use DIRECTLY in the interface
+#include "BVH.hpp"
+#include "QBVH.hpp"
+#include "Object.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <cstdint>
+#include <vector>
+
+// classes we only use by pointer or reference
+class Ray;
+
+// One object for a whole triangle mesh with one surface. Triangles are
+// entries in shared vertex and index buffers, not Objects, and are found
+// through the mesh's own BVH. Intersection::prim is the triangle hit.
+class Mesh : public Object {
+public: // public data
+    // shared buffers: xyz per vertex, three vertex indices per triangle,
+    // triangles in BVH slot order
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+
+private: // private data
+    // per-triangle data for intersection, in the same order as indices:
+    // first vertex and the two edges leaving it
+    struct Triangle {
+        float v0[3], e1[3], e2[3];
+    };
+    std::vector<Triangle> triangles;
+
+    // where ray crosses triangle s before far, if it does
+    bool hitTriangle(const Ray &ray, int s, Real far, Real &t) const;
+
+    BVH bvh;
+    QBVH qbvh;          // replaces bvh when built compressed
+    Vec3 lo, hi;        // bounds of all triangles
+
+public: // constructors
+    Mesh(const Surface &_surface) : Object(_surface) {}
+
+public: // manipulators
+    // read v and f lines of an OBJ file, faces with more than three
+    // vertices as fans, and build; false if the file can't be read
+    bool load(const char *filename, bool compressed = false);
+
+    // build triangles and BVH from the buffers, after load or after
+    // filling vertices and indices directly; compressed collapses the BVH
+    // into quantized four-wide nodes
+    void build(bool compressed = false);
+
+public: // object functions
+    const Intersection intersect(const Ray &ray) const override;
+    const Intersection intersectPrim(const Ray &ray, int prim) const override;
+    const Vec3 normal(const Vec3 P) const override;
+    const Vec3 normal(const Vec3 P, int prim) const override;
+    Object *relocate(SceneArena &arena) override;
+    void bounds(Vec3 &lo, Vec3 &hi) const override;
+
+public: // statistics
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    // bytes held by buffers, triangles and BVH nodes
+    size_t bytes() const;
+};
+
+#endif
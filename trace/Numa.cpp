@@ -0,0 +1,178 @@
+// implementation code for Numa class
+// reads the node layout from sysfs and pins threads with Linux affinity
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Numa.hpp"
+
+// other classes used directly in the implementation
+#include "Accel.hpp"
+
+// system includes
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// numbers in a sysfs list such as "0-3,8-11"
+static std::vector<int> parseList(const std::string &list)
+{
+    std::vector<int> numbers;
+    size_t at = 0;
+    while (at < list.size()) {
+        size_t end = list.find(',', at);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(at, end - at);
+        size_t dash = range.find('-');
+        if (!range.empty() && range.find_first_not_of(" \n") != std::string::npos) {
+            int lo = atoi(range.c_str());
+            int hi = dash == std::string::npos ? lo : atoi(range.c_str() + dash + 1);
+            for (int n = lo; n <= hi; ++n)
+                numbers.push_back(n);
+        }
+        at = end + 1;
+    }
+    return numbers;
+}
+
+Numa::Numa()
+    : known(false)
+{
+#ifdef __linux__
+    // only CPUs the process may run on, as taskset or a cgroup allows
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::string text;
+    std::ifstream online("/sys/devices/system/node/online");
+    if (online && std::getline(online, text))
+        known = true;
+    for (int id : parseList(text)) {
+        std::ifstream list("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+        text.clear();
+        std::getline(list, text);
+
+        Node node;
+        node.id = id;
+        for (int cpu : parseList(text))
+            if (!masked || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                node.cpus.push_back(cpu);
+        if (!node.cpus.empty())
+            nodes.push_back(node);
+    }
+#endif
+
+    if (nodes.empty()) {
+        known = false;
+        Node node;
+        node.id = 0;
+        int count = std::max(1, int(std::thread::hardware_concurrency()));
+        for (int c = 0; c < count; ++c)
+            node.cpus.push_back(c);
+        nodes.push_back(node);
+    }
+}
+
+// workers in contiguous blocks, as even as possible
+int Numa::nodeOf(int worker, int workers) const
+{
+    return int((long long)worker * nodes.size() / std::max(workers, 1));
+}
+
+#ifdef __linux__
+static bool pinTo(const std::vector<int> &cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+#else
+static bool pinTo(const std::vector<int> &)
+{
+    return false;
+}
+#endif
+
+// a worker's place among its node's workers picks the CPU
+bool Numa::pin(int worker, int workers) const
+{
+    int n = nodeOf(worker, workers);
+    int first = worker;
+    while (first > 0 && nodeOf(first - 1, workers) == n)
+        --first;
+    const std::vector<int> &cpus = nodes[n].cpus;
+    return pinTo(std::vector<int>(1, cpus[(worker - first) % cpus.size()]));
+}
+
+bool Numa::pinToNode(int n) const
+{
+    return pinTo(nodes[n].cpus);
+}
+
+std::vector<size_t> Numa::pages(const void *data, size_t bytes) const
+{
+    std::vector<size_t> count;
+#if defined(__linux__) && defined(SYS_move_pages)
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0 || bytes == 0)
+        return count;
+    uintptr_t first = uintptr_t(data) / pageSize * pageSize;
+    uintptr_t last = (uintptr_t(data) + bytes - 1) / pageSize * pageSize;
+    std::vector<void*> addresses;
+    for (uintptr_t page = first; page <= last; page += pageSize)
+        addresses.push_back((void*)page);
+
+    // with no target nodes, move_pages only reports where pages are
+    std::vector<int> status(addresses.size());
+    if (syscall(SYS_move_pages, 0, (unsigned long)addresses.size(), addresses.data(),
+                nullptr, status.data(), 0) != 0)
+        return count;
+
+    count.assign(nodes.size() + 1, 0);
+    for (int s : status) {
+        size_t n = nodes.size();
+        for (size_t k = 0; k < nodes.size(); ++k)
+            if (nodes[k].id == s) n = k;
+        ++count[n];
+    }
+#else
+    (void)data;  (void)bytes;
+#endif
+    return count;
+}
+
+// a thread pinned to each node copies the structure, so the kernel places
+// the copy's pages there on first touch
+bool Numa::replicate(const Accel &accel)
+{
+    replicas.clear();
+    replicas.resize(nodes.size());
+    std::vector<std::thread> copiers;
+    for (size_t n = 0; n < nodes.size(); ++n)
+        copiers.push_back(std::thread([this, &accel, n]{
+            pinToNode(int(n));
+            replicas[n].reset(accel.clone());
+        }));
+    for (auto &copier : copiers)
+        copier.join();
+
+    for (auto &replica : replicas)
+        if (!replica) {
+            replicas.clear();
+            return false;
+        }
+    return true;
+}
@@ -0,0 +1,60 @@
+// NUMA nodes, thread pinning and per-node copies of the scene structure
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+// system includes necessary for the interface
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+// classes we only use by pointer or reference
+class Accel;
+
+// The machine's NUMA nodes and the CPUs on each this process may use,
+// read from Linux sysfs. Workers are dealt out to nodes in contiguous
+// blocks and pinned to one CPU each, so a worker's memory stays on its
+// node. Where the layout can't be read (not Linux, no sysfs) there is one
+// node of every CPU, and pinning does nothing where it isn't supported.
+class Numa {
+public: // public types
+    struct Node {
+        int id;                     // kernel's node number
+        std::vector<int> cpus;      // CPUs on it this process may run on
+    };
+
+public: // public data
+    std::vector<Node> nodes;        // at least one
+    bool known;                     // nodes read from the system, not assumed
+
+public: // constructors
+    Numa();
+
+public: // placement
+    // node worker w of workers runs on
+    int nodeOf(int worker, int workers) const;
+
+    // pin the calling thread to worker w's CPU; false if it can't be
+    bool pin(int worker, int workers) const;
+
+    // pin the calling thread to any CPU of node n
+    bool pinToNode(int n) const;
+
+    // pages of [data, data+bytes) on each node, in node order, plus those
+    // not placed yet or unknown last; empty if pages can't be queried
+    std::vector<size_t> pages(const void *data, size_t bytes) const;
+
+public: // replicas
+    // a copy of accel on each node, each made by a thread pinned there;
+    // false if accel can't be copied, leaving none
+    bool replicate(const Accel &accel);
+
+    // node n's copy, or null for none
+    const Accel *replica(int n) const {
+        return size_t(n) < replicas.size() ? replicas[n].get() : nullptr;
+    }
+
+private:
+    std::vector<std::unique_ptr<Accel> > replicas;
+};
+
+#endif
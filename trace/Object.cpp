@@ -3,6 +3,8 @@
 // include this class include file FIRST to ensure that it has
 // everything it needs for internal self-consistency
 #include "Object.hpp"
+#include "Instance.hpp"
+#include "Texture.hpp"
 #include "World.hpp"
 
 // default constructor just uses default color
@@ -20,91 +22,168 @@ Object::Object(const Surface &_surface) {
 // virtual destructor since this class has virtual members and derived children
 Object::~Object() {}
 
-// shared surface color computation for all object types
-// Color of this object
-const Vec3 Object::color(const World &world, const Ray &ray, float t) const
+// Color of this object, using the kernel chosen for the world's effects
+const Vec3 Object::color(const World &world, const Ray &ray, const Intersection &hit) const
 {
-    // base color
-    Vec3 col(0,0,0);
+    return world.shade(*this, world, ray, hit);
+}
+
+// Effects bit for a kernel that also tests world.effects on every call,
+// the way shading worked before kernels were specialized
+static const unsigned int CheckedEffects = 0x80000000u;
+
+// whether effect bit is on for kernel Effects; constant for every kernel
+// but the checked one
+template <unsigned int Effects>
+static inline bool enabled(const World &world, unsigned int bit)
+{
+    return (Effects & bit) && (!(Effects & CheckedEffects) || (world.effects & bit));
+}
 
-    if ((World::effects & World::AMBIENT))
-        col = surface.ambient;
+// shared surface color computation for all object types
+// every world effects test is on the Effects constant, so disabled
+// features compile out of each specialization
+template <unsigned int Effects>
+const Vec3 Object::shade(const World &world, const Ray &ray, const Intersection &hit) const
+{
+    // appearance of the part that was hit
+    const Surface &surf = surfaceOf(hit.prim);
 
     // view ray
     Vec3 V = -normalize(ray.D);
 
-    // position and normal at intersection
-    Vec3 P = ray.E + t * ray.D;
-    Vec3 N = normal(P);
+    // world-space position and normal at intersection
+    Vec3 P = ray.E + hit.t * ray.D;
+    Vec3 N = hit.inst ? hit.inst->normal(this, hit.prim, P) : normal(P, hit.prim);
+
+    // width of the pixel footprint here
+    Real footprint = ray.width + ray.spread * hit.t * std::sqrt(ray.D_dot_D);
+
+    // ambient and diffuse colors, textured if there's a texture and a mapping
+    Vec3 ambient = surf.ambient, diffuse = surf.diffuse;
+    Real u, v, scale;
+    if (surf.texture &&
+        uv(hit.inst ? hit.inst->objectPoint(P) : P, hit.prim, u, v, scale)) {
+        Vec3 texel = surf.texture->sample(u, v, footprint / scale);
+        ambient = ambient * texel;
+        diffuse = diffuse * texel;
+    }
+
+    // base color
+    Vec3 col(0,0,0);
+
+    if (enabled<Effects>(world, World::AMBIENT))
+        col = ambient;
 
     // diffuse and specular
-    for (auto li : world.lights) {
+    for (const auto &li : world.lights) {
 
-        Vec3 L = li.pos - P;   // light vector
-        float LLen = length(L);
-        L = L / LLen;
+        Real LLen;
+        Vec3 L = normalize_len(li.pos - P, LLen);  // light vector
 
-        float N_dot_L = dot(N,L);
+        Real N_dot_L = dot(N,L);
 
         // check for negative dot product first to avoid shadow cast
         if (N_dot_L > 0) {
 
             // cast ray to see if it's in shadow
-            if (! (World::effects & World::SHADOW) || 
-                ! world.objects->probe(Ray(P, L, 1e-4f, LLen))) {
+            if (! enabled<Effects>(world, World::SHADOW) ||
+                ! world.probe(Ray(P, L, Real(1e-4), LLen))) {
 
-                if (World::effects & World::DIFFUSE)
-                    col = col + li.col * surface.diffuse * N_dot_L;
+                if (enabled<Effects>(world, World::DIFFUSE))
+                    col = col + li.col * diffuse * N_dot_L;
 
-                if ((World::effects & World::SPECULAR) && 
-                    surface.specular[0]+surface.specular[1]+surface.specular[2] > 0.f) {
+                if (enabled<Effects>(world, World::SPECULAR) &&
+                    surf.specular[0]+surf.specular[1]+surf.specular[2] > 0.f) {
 
                     // normalized L and H
                     Vec3 H = normalize(V+L);
 
-                    float N_dot_H = dot(N,H);
+                    Real N_dot_H = dot(N,H);
                     if (N_dot_H > 0)
-                        col = col + li.col * surface.specular * pow(N_dot_H, surface.e);
+                        col = col + li.col * surf.specular * pow(N_dot_H, surf.e);
                 }
             }
         }
     }
 
     // reflected rays
-    if ((World::effects & World::REFLECT) &&
-        ray.influence * surface.kr > world.cutoff && ray.bounces > 0) {
+    if (enabled<Effects>(world, World::REFLECT) &&
+        ray.influence * surf.kr > ray.cutoff && ray.bounces > 0) {
 
         // reflect ray off surface
-        Vec3 rv = ray.D - 2*dot(N, ray.D)*N;
+        Vec3 rv = reflect(ray.D, N);
 
         // new ray with one less bounce and influence reduced by kr
-        Ray rr(P, rv, 1e-4f, INFINITY, ray.bounces-1, ray.influence*surface.kr);
-        Vec3 rc = world.objects->trace(rr).color(world,rr); // trace ray
-        col = col + surface.kr * rc;
+        Ray rr(P, rv, Real(1e-4), INFINITY, ray.bounces-1, ray.influence*surf.kr);
+        rr.width = footprint;
+        rr.spread = ray.spread;
+        rr.cutoff = ray.cutoff;
+        Intersection ri = world.trace(rr);      // trace ray
+        Vec3 rc = ri.obj ? ri.obj->shade<Effects>(world, rr, ri) : world.background;
+        col = col + surf.kr * rc;
     }
 
     // refracted rays
-    if ((World::effects & World::REFRACT) &&
-            ray.influence * surface.kt > world.cutoff && ray.bounces > 0) {
-
-        // compute refracted ray
-        float ci = dot(N,V);                // cosine of incident ray angle
-        float tir = ci > 0 ? 1/surface.ir : surface.ir;     // ratio of air to object or object to air
-        float ct2 = 1-(1-ci*ci)*tir*tir;    // cosine squared of refracted ray
-        if (ct2 > 0) {                  // <=0 for total internal reflection
-            // ray direction
-            Vec3 td;
-            if (ci>0)                   // into surface
-                td = N*(ci*tir - sqrtf(ct2)) - V*tir;
-            else                        // out of surface
-                td = N*(ci*tir + sqrtf(ct2)) - V*tir;
+    if (enabled<Effects>(world, World::REFRACT) &&
+            ray.influence * surf.kt > ray.cutoff && ray.bounces > 0) {
 
+        // compute refracted ray direction, false for total internal reflection
+        Vec3 td;
+        if (refract(V, N, surf.ir, td)) {
             // new ray with one fewer bounce and influence reduced by kt
-            Ray tr(P, td, 1e-4f, INFINITY, ray.bounces-1, ray.influence*surface.kt);
-            Vec3 tc = world.objects->trace(tr).color(world,tr); // trace ray
-            col = col + surface.kt * tc;
+            Ray tr(P, td, Real(1e-4), INFINITY, ray.bounces-1, ray.influence*surf.kt);
+            tr.width = footprint;
+            tr.spread = ray.spread;
+            tr.cutoff = ray.cutoff;
+            Intersection ti = world.trace(tr);  // trace ray
+            Vec3 tc = ti.obj ? ti.obj->shade<Effects>(world, tr, ti) : world.background;
+            col = col + surf.kt * tc;
         }
     }
 
     return col;
 }
+
+// shading bits of World::Effects, and how far they are shifted up
+static const unsigned int ShadeShift = 1;
+static const unsigned int ShadeMask = World::AMBIENT | World::DIFFUSE |
+    World::SPECULAR | World::SHADOW | World::REFLECT | World::REFRACT;
+static const unsigned int KernelCount = (ShadeMask >> ShadeShift) + 1;
+
+// free-function wrapper so each specialization has a plain function pointer
+template <unsigned int Effects>
+static const Vec3 shadeWith(const Object &obj, const World &w, const Ray &r,
+                            const Intersection &hit)
+{
+    return obj.shade<Effects>(w, r, hit);
+}
+
+// instantiate kernels for every combination of shading bits, N-1 down to 0
+template <unsigned int N>
+struct KernelTable {
+    static void fill(Object::ShadeKernel *table) {
+        table[N-1] = &shadeWith<((N-1) << ShadeShift) & ShadeMask>;
+        KernelTable<N-1>::fill(table);
+    }
+};
+template <>
+struct KernelTable<0> {
+    static void fill(Object::ShadeKernel *) {}
+};
+
+// look up the kernel for the shading bits in effects
+Object::ShadeKernel Object::shadeKernel(unsigned int effects)
+{
+    static Object::ShadeKernel table[KernelCount];
+    static bool filled = (KernelTable<KernelCount>::fill(table), true);
+    (void)filled;
+
+    return table[(effects & ShadeMask) >> ShadeShift];
+}
+
+// every shading bit compiled in, each tested against world.effects
+Object::ShadeKernel Object::checkedKernel()
+{
+    return &shadeWith<ShadeMask | CheckedEffects>;
+}
@@ -9,16 +9,20 @@
 // classes we only use by pointer or reference
 class World;
 class Ray;
+class Texture;
+class SceneArena;
 
 // collected surface appearance parameters
 struct Surface {
     Vec3 ambient;   // ambient color
     Vec3 diffuse;   // diffuse color
     Vec3 specular;  // specular color
-    float e;        // specular coefficient
-    float kr, kt, ir;   // reflection and transmission coeffients & index of refraction
+    Real e;        // specular coefficient
+    Real kr, kt, ir;   // reflection and transmission coeffients & index of refraction
+    const Texture *texture;    // modulates ambient and diffuse, if not null
 
-    Surface() : ambient(0,0,0), diffuse(1,1,1), specular(0,0,0), e(0), kr(0), kt(0), ir(1) {}
+    Surface() : ambient(0,0,0), diffuse(1,1,1), specular(0,0,0), e(0), kr(0), kt(0), ir(1),
+                texture(nullptr) {}
 };
 
 class Object {
@@ -36,14 +40,50 @@ public: // computational members
     // return t for closest intersection with ray
     virtual const Intersection intersect(const Ray &ray) const = 0;
 
+    // intersection with part prim alone, for objects made of many parts
+    virtual const Intersection intersectPrim(const Ray &ray, int /*prim*/) const {
+        return intersect(ray);
+    }
+
     // normal for at point P
     virtual const Vec3 normal(const Vec3 P) const = 0;
 
-    virtual Vec3 getCenter() = 0;
-    virtual float getRadius() = 0;
+    // normal at point P on part prim, for objects made of many parts
+    virtual const Vec3 normal(const Vec3 P, int /*prim*/) const { return normal(P); }
+
+    // texture coordinates at P on part prim, and the world-space length
+    // one unit of u spans; false if the object has no texture mapping
+    virtual bool uv(const Vec3 /*P*/, int /*prim*/, Real &/*u*/, Real &/*v*/,
+                    Real &/*scale*/) const {
+        return false;
+    }
+
+    // appearance of part prim, for objects whose parts differ
+    virtual const Surface &surfaceOf(int /*prim*/) const { return surface; }
+
+    // move this object into arena, leaving this one to be destroyed
+    virtual Object *relocate(SceneArena &arena) = 0;
+
+    // axis-aligned box containing the object
+    virtual void bounds(Vec3 &lo, Vec3 &hi) const = 0;
+
+    // compute color at ray intersection hit, with the world's shading kernel
+    const Vec3 color(const World &w, const Ray &r, const Intersection &hit) const;
+
+    // color computation compiled for one fixed set of World::Effects bits
+    template <unsigned int Effects>
+    const Vec3 shade(const World &w, const Ray &r, const Intersection &hit) const;
+
+public: // shading kernel selection
+    typedef const Vec3 (*ShadeKernel)(const Object &obj, const World &w,
+                                      const Ray &r, const Intersection &hit);
+
+    // kernel specialized for the shading bits set in effects
+    static ShadeKernel shadeKernel(unsigned int effects);
 
-	// compute color at ray intersection
-	const Vec3 color(const World &w, const Ray &r, float t) const;
+    // one kernel testing World::effects on every call instead, to compare
+    // against the specialized ones
+    static ShadeKernel checkedKernel();
 };
 
 #endif
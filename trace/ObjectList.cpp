@@ -6,16 +6,30 @@
 #include "ObjectList.hpp"
 #include "Object.hpp"
 #include <iostream>
-#include <atomic>
 
-static std::atomic<int> RayCount(0), ShadowCount(0);
+RayCounts RayCounts::process;
+thread_local RayCounts *RayCounts::current = &RayCounts::process;
+thread_local RayCounts::Pending RayCounts::pending;
 
-// delete list and objects it contains
-ObjectList::~ObjectList() {
-    std::cout << RayCount << " Photon Ray" << (RayCount == 1 ? "" : "s") << "; "
-        << ShadowCount << " Shadow Ray" << (ShadowCount == 1 ? "" : "s") << '\n';
-    for(auto obj : objects)
-        delete obj;
+void RayCounts::flush() {
+    if (pending.textureHits || pending.textureMisses) {
+        current->textureHits += pending.textureHits;
+        current->textureMisses += pending.textureMisses;
+        pending.textureHits = pending.textureMisses = 0;
+    }
+}
+
+// ray counts for one render
+void ObjectList::printStats(const RayCounts &counts) {
+    unsigned long long rays = counts.rays, shadows = counts.shadows;
+    std::cout << rays << " Photon Ray" << (rays == 1 ? "" : "s") << "; "
+        << shadows << " Shadow Ray" << (shadows == 1 ? "" : "s") << '\n';
+}
+
+// copy refers to the same objects
+ObjectList::ObjectList(const ObjectList& rhs)
+	: objects(rhs.objects)
+{
 }
 
 const ObjectList& ObjectList::operator=(const ObjectList& rhs)
@@ -33,7 +47,7 @@ const ObjectList& ObjectList::operator=(const ObjectList& rhs)
 const Intersection
 ObjectList::trace(Ray r) const
 {
-    ++RayCount;
+    ++RayCounts::current->rays;
     Intersection closest;       // no object, t = infinity
     for(auto obj : objects) {
         Intersection current = obj->intersect(r);
@@ -48,7 +62,7 @@ ObjectList::trace(Ray r) const
 const bool
 ObjectList::probe(Ray r) const
 {
-    ++ShadowCount;
+    ++RayCounts::current->shadows;
     for(auto obj : objects) {
         if (obj->intersect(r).t < r.far)
             return true;
@@ -56,30 +70,30 @@ ObjectList::probe(Ray r) const
     return false;
 }
 
-int ObjectList::determineSplitAxis(float& min, float& max) {
-	float minValue[3];
-	float maxValue[3];
+int ObjectList::determineSplitAxis(Real& min, Real& max) {
+	Real minValue[3];
+	Real maxValue[3];
 
+	Vec3 lo, hi;
+	objects[0]->bounds(lo, hi);
 	for (int i = 0; i < 3; i++) {
-		Object* obj = objects[0];
-		minValue[i] = obj->getCenter()[i] - obj->getRadius();
-		maxValue[i] = obj->getCenter()[i] + obj->getRadius();
+		minValue[i] = lo[i];
+		maxValue[i] = hi[i];
 	}
 
 	for (auto obj : objects) {
-		Vec3 center = obj->getCenter();
-		float radius = obj->getRadius();
+		obj->bounds(lo, hi);
 
 		for (int i = 0; i < 3; i++) {
-			minValue[i] = std::min(minValue[i], center[i] - radius);
-			maxValue[i] = std::max(maxValue[i], center[i] + radius);
+			minValue[i] = std::min(minValue[i], lo[i]);
+			maxValue[i] = std::max(maxValue[i], hi[i]);
 		}
 	}
 
 	int axis = 0;
-	float range = maxValue[0] - minValue[0];
+	Real range = maxValue[0] - minValue[0];
 	for (int i = 1; i < 3; i++) {
-		float tmpRange = maxValue[i] - minValue[i];
+		Real tmpRange = maxValue[i] - minValue[i];
 		if (tmpRange > range) {
 			range = tmpRange;
 			axis = i;
@@ -7,11 +7,43 @@
 #include "Ray.hpp"
 
 // system includes
+#include <atomic>
 #include <vector>
 
 // classes we only use by pointer or reference
 class Object;
 
+// rays and shadow rays traced for one render, through lists or the
+// acceleration structures built on them, and texture cache lookups
+struct RayCounts {
+    std::atomic<unsigned long long> rays, shadows;
+    std::atomic<unsigned long long> textureHits, textureMisses;
+    RayCounts() : rays(0), shadows(0), textureHits(0), textureMisses(0) {}
+
+    // where the calling thread's traces are counted: process, unless a
+    // Scope has pointed it at a render's own counts
+    static thread_local RayCounts *current;
+    static RayCounts process;
+
+    // texture lookups the calling thread has made but not yet added to
+    // current, counted without touching shared memory
+    struct Pending {
+        unsigned long long textureHits, textureMisses;
+    };
+    static thread_local Pending pending;
+
+    // add the calling thread's pending counts to current
+    static void flush();
+
+    // count the calling thread's traces in counts while in scope
+    class Scope {
+        RayCounts *saved;
+    public:
+        Scope(RayCounts *counts) : saved(current) { flush(); if (counts) current = counts; }
+        ~Scope() { flush(); current = saved; }
+    };
+};
+
 class ObjectList {
 public: // data
     // list of objects
@@ -20,12 +52,12 @@ public: // data
 
 public: // constructor & destructor
     ObjectList() {}
-    ~ObjectList();
+    ObjectList(const ObjectList& rhs);
     const ObjectList& operator=(const ObjectList& rhs);
 
 public:
-    // Add an object to the list. Objects should be allocated with
-    // new. Objects will be deleted when this ObjectList is destroyed
+    // Add an object to the list. The list only refers to objects; they are
+    // owned by the scene's SceneArena, so several lists can share them
     void addObject(Object *obj) { objects.push_back(obj); }
     // Removes the object at given index
     void removeObject(int index) { objects.erase(objects.begin() + index); }
@@ -45,7 +77,10 @@ public: // computational members
     const bool probe(Ray r) const;
 
     // determines the split axis and min and max values of that axis
-    int determineSplitAxis(float& min, float& max);
+    int determineSplitAxis(Real& min, Real& max);
+
+    // print how many rays and shadow rays have been traced
+    static void printStats(const RayCounts &counts);
 };
 
 #endif
@@ -0,0 +1,137 @@
+// implementation code for PathTracer class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "PathTracer.hpp"
+
+// other classes used directly in the implementation
+#include "Instance.hpp"
+#include "Object.hpp"
+#include "Ray.hpp"
+#include "Texture.hpp"
+#include "World.hpp"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+
+static Real average(const Vec3 &c)
+{
+    return (c[0] + c[1] + c[2]) / 3;
+}
+
+// unit direction at angle acos(cosTheta) from unit n, turned phi around it
+static Vec3 around(const Vec3 &n, Real cosTheta, Real phi)
+{
+    Vec3 a = std::fabs(n[0]) > Real(0.9) ? Vec3(0,1,0) : Vec3(1,0,0);
+    Vec3 t = normalize(cross(a, n));
+    Vec3 b = cross(n, t);
+    Real sinTheta = std::sqrt(std::max(Real(0), 1 - cosTheta * cosTheta));
+    return t * (sinTheta * std::cos(phi)) + b * (sinTheta * std::sin(phi)) + n * cosTheta;
+}
+
+Vec3 PathTracer::radiance(Ray ray, Random &random) const
+{
+    Vec3 sum(0,0,0), throughput(1,1,1);
+    for (int bounce = 0; ; ++bounce) {
+        Intersection hit = world.trace(ray);
+        if (!hit.obj) {
+            sum = sum + throughput * world.background;
+            break;
+        }
+        const Object &obj = *hit.obj;
+        const Surface &surf = obj.surfaceOf(hit.prim);
+
+        // view vector, position and normal, the normal turned to face the
+        // view for scattering off either side
+        Vec3 V = -normalize(ray.D);
+        Vec3 P = ray.E + hit.t * ray.D;
+        Vec3 N = hit.inst ? hit.inst->normal(hit.obj, hit.prim, P) : obj.normal(P, hit.prim);
+        Vec3 Nf = dot(N, V) < 0 ? -N : N;
+
+        // diffuse color, textured as in Object::shade
+        Real footprint = ray.width + ray.spread * hit.t * std::sqrt(ray.D_dot_D);
+        Vec3 diffuse = surf.diffuse;
+        Real u, v, scale;
+        if (surf.texture &&
+            obj.uv(hit.inst ? hit.inst->objectPoint(P) : P, hit.prim, u, v, scale))
+            diffuse = diffuse * surf.texture->sample(u, v, footprint / scale);
+        bool glossy = surf.e > 0 && average(surf.specular) > 0;
+
+        // next-event estimation: each light through a shadow ray
+        if (average(diffuse) > 0 || glossy) {
+            for (const auto &li : world.lights) {
+                Real LLen;
+                Vec3 L = normalize_len(li.pos - P, LLen);
+                Real N_dot_L = dot(Nf, L);
+                if (N_dot_L <= 0 || world.probe(Ray(P, L, Real(1e-4), LLen)))
+                    continue;
+
+                Vec3 f = diffuse * N_dot_L;
+                if (glossy) {
+                    Real N_dot_H = dot(Nf, normalize(V + L));
+                    if (N_dot_H > 0)
+                        f = f + surf.specular * Real(std::pow(N_dot_H, surf.e));
+                }
+                sum = sum + throughput * li.col * f;
+            }
+        }
+        if (bounce >= maxBounces)
+            break;
+
+        // pick one way to scatter, in proportion to its weight, and divide
+        // by the chance of picking it; Whitted surfaces can add up to more
+        // than all the light that arrives, so those are scaled to conserve
+        // energy or paths would grow brighter with every bounce
+        Real wd = average(diffuse), wg = glossy ? average(surf.specular) : 0;
+        Real wr = surf.kr, wt = surf.kt;
+        Real total = wd + wg + wr + wt;
+        if (total <= 0)
+            break;
+        Real albedo = std::min(total, Real(1));
+        Real pick = random.next() * total;
+        Real r1 = random.next(), r2 = random.next();
+
+        Vec3 dir, weight;
+        if (pick < wd) {
+            // cosine-weighted hemisphere: BRDF*cos/pdf is the color
+            dir = around(Nf, std::sqrt(r1), Real(2 * M_PI) * r2);
+            weight = diffuse * (albedo / wd);
+        }
+        else if (pick < wd + wg) {
+            // Phong lobe about the mirror direction
+            Vec3 mirror = normalize(reflect(ray.D, Nf));
+            dir = around(mirror, Real(std::pow(r1, 1 / (surf.e + 1))), Real(2 * M_PI) * r2);
+            Real cosine = dot(Nf, dir);
+            if (cosine <= 0)
+                break;
+            weight = surf.specular * ((surf.e + 2) / (surf.e + 1) * cosine * albedo / wg);
+        }
+        else if (pick < wd + wg + wr) {
+            dir = reflect(ray.D, N);
+            weight = Vec3(1,1,1) * (surf.kr * albedo / wr);
+        }
+        else {
+            // total internal reflection sends the light back inside
+            if (!refract(V, N, surf.ir, dir))
+                dir = reflect(ray.D, N);
+            weight = Vec3(1,1,1) * (surf.kt * albedo / wt);
+        }
+        throughput = throughput * weight;
+
+        // Russian roulette: dim paths stop early, survivors make up for it
+        if (bounce >= rouletteDepth) {
+            Real survive = std::min(Real(0.95),
+                std::max(throughput[0], std::max(throughput[1], throughput[2])));
+            if (random.next() >= survive)
+                break;
+            throughput = throughput / survive;
+        }
+
+        Ray next(P, dir, Real(1e-4), INFINITY, 0, 1);
+        next.width = footprint;
+        next.spread = ray.spread;
+        ray = next;
+    }
+    return sum;
+}
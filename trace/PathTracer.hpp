@@ -0,0 +1,66 @@
+// Monte Carlo path tracing integrator
+#ifndef PATHTRACER_HPP
+#define PATHTRACER_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <cstdint>
+
+// classes we only use by pointer or reference
+class World;
+class Ray;
+
+// small, fast generator for sample numbers; seeded per pixel and sample so
+// images don't depend on which thread drew which sample
+class Random {
+    uint64_t state;
+
+public:
+    Random(uint64_t seed, uint64_t stream) : state(0) {
+        next();
+        state += seed + stream * 0x9E3779B97F4A7C15ull;
+        next();
+    }
+
+    // uniform in [0,1)
+    Real next() {
+        // PCG-style: linear congruential step, output xorshifted and rotated
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t x = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        x = (x >> rot) | (x << ((32 - rot) & 31));
+        return Real(x >> 8) * Real(1.0 / (1 << 24));
+    }
+};
+
+// One path per sample through the world's surfaces. Surfaces scatter into
+// a diffuse, glossy (specular color and exponent), mirror (kr) or
+// transmitted (kt) direction, chosen at random by weight. Every diffuse or
+// glossy vertex also samples each light directly through a shadow ray,
+// which is the only way point lights are reached. Paths end when they
+// leave the scene, where they pick up the background, or by Russian
+// roulette on their throughput.
+//
+// Lights follow the Whitted shading: direct light off a surface is
+// diffuse*N.L + specular*(N.H)^e with no distance falloff, so the two
+// modes agree on directly lit surfaces. Ambient terms are not used; the
+// indirect light they stand in for is traced.
+class PathTracer {
+public: // public data
+    const World &world;
+    int rouletteDepth;      // bounces before Russian roulette starts
+    int maxBounces;         // hard stop for paths roulette keeps alive
+
+public: // constructor
+    PathTracer(const World &_world)
+        : world(_world), rouletteDepth(3), maxBounces(64) {}
+
+public: // computational members
+    // light arriving back along ray
+    Vec3 radiance(Ray ray, Random &random) const;
+};
+
+#endif
@@ -5,10 +5,14 @@
 #include "Polygon.hpp"
 
 // other classes used directly in the implementation
+#include "SceneArena.hpp"
 #include "World.hpp"
 #include "Ray.hpp"
 #include "Intersection.hpp"
 
+// system includes
+#include <algorithm>
+
 void
 Polygon::addVertex(const Vec3 v)
 {
@@ -33,17 +37,28 @@ Polygon::closePolygon()
 
     // precomputed values for intersection testing
     V0_dot_N = dot(V0, N);
+    lo = hi = V0;
+    Real Tmax, Bmax;
+    Tmin = Tmax = dot(V0, T);
+    Bmin = Bmax = dot(V0, B);
     for(auto &vert : vertices) {
         vert.Vt = dot(vert.V, T);
         vert.Vb = dot(vert.V, B);
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = std::min(lo[a], vert.V[a]);
+            hi[a] = std::max(hi[a], vert.V[a]);
+        }
+        Tmin = std::min(Tmin, vert.Vt);  Tmax = std::max(Tmax, vert.Vt);
+        Bmin = std::min(Bmin, vert.Vb);  Bmax = std::max(Bmax, vert.Vb);
     }
+    extent = std::max(Tmax - Tmin, Bmax - Bmin);
 }
 
 const Intersection
 Polygon::intersect(const Ray &ray) const 
 {
     // compute intersection point with plane
-    float t = (V0_dot_N - dot(N, ray.E)) / dot(N, ray.D);
+    Real t = (V0_dot_N - dot(N, ray.E)) / dot(N, ray.D);
 
     if (t < ray.near || t > ray.far)
         return Intersection();  // not in ray bounds: no intersection
@@ -51,17 +66,17 @@ Polygon::intersect(const Ray &ray) const
     Vec3 P = ray.E + ray.D * t;
 
     // project P to onto plane basis vectors
-    float Pt = dot(P, T), Pb = dot(P, B);
+    Real Pt = dot(P, T), Pb = dot(P, B);
 
     // check if intersection is inside or outside
     // trace ray from p along a tangent vector and count even/odd intersections
     bool inside = false;
     for(auto v1 = vertices.begin(), v0 = v1++; v1 != vertices.end(); v0 = v1, ++v1) {
         // does edge straddle test ray where q dot bitangent = p dot bitangent?
-        float b0 = v1->Vb - Pb, b1 = Pb - v0->Vb;
+        Real b0 = v1->Vb - Pb, b1 = Pb - v0->Vb;
         if ((b0 > 0) ^ (b1 < 0)) {
             // outbound on test ray?
-            float Qt = (b0 * v0->Vt + b1 * v1->Vt)/(v1->Vb - v0->Vb);
+            Real Qt = (b0 * v0->Vt + b1 * v1->Vt)/(v1->Vb - v0->Vb);
             if (Qt > Pt)
                 inside = !inside;
         }
@@ -76,3 +91,24 @@ const Vec3 Polygon::normal(const Vec3 P) const
 {
     return N;
 }
+
+void Polygon::bounds(Vec3 &_lo, Vec3 &_hi) const
+{
+    _lo = lo;
+    _hi = hi;
+}
+
+// planar map over the square around the polygon in its T,B basis
+bool Polygon::uv(const Vec3 P, int /*prim*/, Real &u, Real &v, Real &scale) const
+{
+    if (!(extent > 0)) return false;
+    u = (dot(P, T) - Tmin) / extent;
+    v = (dot(P, B) - Bmin) / extent;
+    scale = extent;
+    return true;
+}
+
+Object *Polygon::relocate(SceneArena &arena)
+{
+    return arena.make<Polygon>(std::move(*this));
+}
@@ -20,9 +20,9 @@ private: // private data
         Vec3 V;              // vertex location
 
         // derived, for intersection testing
-        float Vt, Vb;   // coordinates in basis
+        Real Vt, Vb;   // coordinates in basis
         
-        PolyVert(const Vec3 _V) { V = _V; }
+        PolyVert(const Vec3 _V) : V(_V), Vt(0), Vb(0) {}
     };
     typedef std::vector<PolyVert> VertexList;
 
@@ -32,7 +32,14 @@ private: // private data
     Vec3 B;                 // 2nd basis vector in polygon plane
 
     // derived, for intersection testing
-    float V0_dot_N;
+    Real V0_dot_N;
+
+    // derived, box around the vertices
+    Vec3 lo, hi;
+
+    // derived, for texture mapping: smallest T and B coordinates and the
+    // larger of the T and B extents
+    Real Tmin, Bmin, extent;
 
 public: // constructors
     Polygon(const Surface &_surface) : Object(_surface) {}
@@ -48,6 +55,9 @@ public: // manipulators
 public: // object functions
     const Intersection intersect(const Ray &ray) const override;
     const Vec3 normal(const Vec3 P) const override;
+    bool uv(const Vec3 P, int prim, Real &u, Real &v, Real &scale) const override;
+    Object *relocate(SceneArena &arena) override;
+    void bounds(Vec3 &_lo, Vec3 &_hi) const override;
 };
 
 #endif
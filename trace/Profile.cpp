@@ -0,0 +1,119 @@
+// implementation code for Profile class
+// per-thread span buffers and Chrome trace-event output
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Profile.hpp"
+
+// system includes
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> Profile::active(false);
+
+namespace {
+    struct Span {
+        const char *name;
+        Profile::Clock::time_point begin, end;
+        int thread;
+    };
+
+    // spans of threads that have ended, and buffers of those still running
+    struct Buffer;
+    std::mutex lock;
+    std::vector<Span> finished;
+    std::vector<Buffer*> running;
+    int threadCount = 0;
+    std::vector<int> freeThreads;   // numbers of ended threads, to reuse
+    Profile::Clock::time_point epoch;
+
+    // One thread's spans, handed over to finished when the thread ends.
+    // The thread takes the lowest number an ended thread left, so threads
+    // made per request share the rows of the ones before them.
+    struct Buffer {
+        int thread;
+        std::mutex guard;           // spans, against write() on another thread
+        std::vector<Span> spans;
+
+        Buffer() {
+            std::lock_guard<std::mutex> hold(lock);
+            if (freeThreads.empty())
+                thread = threadCount++;
+            else {
+                auto lowest = std::min_element(freeThreads.begin(), freeThreads.end());
+                thread = *lowest;
+                freeThreads.erase(lowest);
+            }
+            running.push_back(this);
+        }
+        ~Buffer() {
+            std::lock_guard<std::mutex> hold(lock);
+            finished.insert(finished.end(), spans.begin(), spans.end());
+            running.erase(std::find(running.begin(), running.end(), this));
+            freeThreads.push_back(thread);
+        }
+    };
+
+    Buffer &threadBuffer()
+    {
+        static thread_local Buffer buffer;
+        return buffer;
+    }
+}
+
+void Profile::start()
+{
+    epoch = Clock::now();
+    threadBuffer();         // the starting thread is the first, "main"
+    active = true;
+}
+
+void Profile::add(const char *name, Clock::time_point begin, Clock::time_point end)
+{
+    Buffer &buffer = threadBuffer();
+    Span span = { name, begin, end, buffer.thread };
+    std::lock_guard<std::mutex> hold(buffer.guard);
+    buffer.spans.push_back(span);
+}
+
+// complete ("X") events in microseconds, with a name for each thread
+bool Profile::write(const char *filename)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    std::vector<Span> spans(finished);
+    for (auto buffer : running) {
+        std::lock_guard<std::mutex> holdBuffer(buffer->guard);
+        spans.insert(spans.end(), buffer->spans.begin(), buffer->spans.end());
+    }
+
+    std::ofstream out(filename);
+    out << "{\"traceEvents\":[\n";
+    for (int t = 0; t < threadCount; ++t)
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+            << ",\"args\":{\"name\":\""
+            << (t == 0 ? std::string("main") : "thread " + std::to_string(t))
+            << "\"}},\n";
+    out.precision(3);
+    out << std::fixed;
+    for (size_t s = 0; s < spans.size(); ++s) {
+        const Span &span = spans[s];
+        out << "{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << span.thread << ",\"ts\":"
+            << std::chrono::duration<double, std::micro>(span.begin - epoch).count()
+            << ",\"dur\":"
+            << std::chrono::duration<double, std::micro>(span.end - span.begin).count()
+            << '}' << (s + 1 < spans.size() ? ",\n" : "\n");
+    }
+    out << "],\"displayTimeUnit\":\"ms\"}\n";
+
+    if (!out) {
+        std::cerr << "Error writing " << filename << '\n';
+        return false;
+    }
+    std::cout << "wrote " << spans.size() << " spans on " << threadCount
+        << " thread" << (threadCount == 1 ? "" : "s") << " to " << filename << '\n';
+    return true;
+}
@@ -0,0 +1,63 @@
+// scoped timers recorded as Chrome trace events
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+// system includes necessary for the interface
+#include <atomic>
+#include <chrono>
+
+// Spans of time on each thread, written as Chrome trace-event JSON for a
+// trace viewer (chrome://tracing, Perfetto). Nothing is kept until
+// start(); spans go to a buffer per thread, collected when the thread ends
+// or when the file is written, which may happen while other threads are
+// still adding spans. Threads are numbered from 0 with numbers reused once
+// a thread ends, so the timeline has a row per thread running at once.
+//
+// PROFILE_SCOPE("name") times the rest of the enclosing block. Built
+// without TRACE_PROFILE, it compiles to nothing.
+//
+// Recording is for the whole process, like the viewer's timeline.
+class Profile {
+public: // recording
+    // keep spans from now on
+    static void start();
+
+    // write every span kept so far to filename; false if it can't be
+    // written
+    static bool write(const char *filename);
+
+    static bool recording() { return active.load(std::memory_order_relaxed); }
+
+public: // spans
+    typedef std::chrono::steady_clock Clock;
+
+    // one span, from construction to destruction; name must outlive the
+    // recording, as string literals do
+    class Scope {
+        const char *name;
+        Clock::time_point begin;
+    public:
+        Scope(const char *_name) : name(recording() ? _name : nullptr) {
+            if (name) begin = Clock::now();
+        }
+        ~Scope() {
+            if (name) add(name, begin, Clock::now());
+        }
+    };
+
+    // keep a span on the calling thread
+    static void add(const char *name, Clock::time_point begin, Clock::time_point end);
+
+private:
+    static std::atomic<bool> active;
+};
+
+#ifdef TRACE_PROFILE
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) Profile::Scope PROFILE_JOIN(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif
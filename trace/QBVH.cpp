@@ -0,0 +1,102 @@
+// implementation code for QBVH class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "QBVH.hpp"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+
+// surface area of a binary node's box, to pick which child to open
+static float area(const BVHNode &n)
+{
+    float dx = n.hi[0] - n.lo[0], dy = n.hi[1] - n.lo[1], dz = n.hi[2] - n.lo[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+bool QBVH::build(const BVH &bvh, const std::function<uint32_t(int, int)> &payload)
+{
+    nodes.clear();
+    if (bvh.nodes.empty()) return true;
+    nodes.reserve(bvh.nodes.size() / 3 + 1);
+    if (collapse(bvh, 0, payload) < 0) {
+        std::vector<QBVHNode>().swap(nodes);
+        return false;
+    }
+    nodes.shrink_to_fit();
+    return true;
+}
+
+// Children are the binary node's descendants: open the interior child with
+// the largest area until there are four or only leaves are left. A binary
+// root that is itself a leaf becomes a node with one leaf child.
+int QBVH::collapse(const BVH &bvh, int node, const std::function<uint32_t(int, int)> &payload)
+{
+    const BVHNode &b = bvh.nodes[node];
+    int kids[4], count = 0;
+    if (b.count)
+        kids[count++] = node;
+    else {
+        kids[count++] = node + 1;
+        kids[count++] = b.offset;
+        while (count < 4) {
+            int open = -1;
+            for (int k = 0; k < count; ++k)
+                if (!bvh.nodes[kids[k]].count &&
+                    (open < 0 || area(bvh.nodes[kids[k]]) > area(bvh.nodes[kids[open]])))
+                    open = k;
+            if (open < 0) break;
+            int opened = kids[open];
+            kids[open] = opened + 1;
+            kids[count++] = bvh.nodes[opened].offset;
+        }
+    }
+
+    int index = int(nodes.size());
+    nodes.push_back(QBVHNode());
+
+    // grid over the node box: 2^e steps, with 255 steps reaching past the top
+    QBVHNode q = QBVHNode();
+    q.count = uint8_t(count);
+    float step[3];
+    for (int a = 0; a < 3; ++a) {
+        q.origin[a] = b.lo[a];
+        int e;
+        std::frexp(std::max((b.hi[a] - b.lo[a]) / 255, 1e-30f), &e);
+        while (q.origin[a] + std::ldexp(255.f, e) < b.hi[a]) ++e;
+        e = std::max(-126, std::min(127, e));
+        q.exponent[a] = int8_t(e);
+        step[a] = power(e);
+    }
+
+    for (int k = 0; k < count; ++k) {
+        const BVHNode &c = bvh.nodes[kids[k]];
+        for (int a = 0; a < 3; ++a) {
+            // round outward, then fix any float rounding in the decode
+            int lo = int(std::floor((c.lo[a] - q.origin[a]) / step[a]));
+            int hi = int(std::ceil((c.hi[a] - q.origin[a]) / step[a]));
+            lo = std::max(0, std::min(255, lo));
+            hi = std::max(0, std::min(255, hi));
+            while (lo > 0 && q.origin[a] + lo * step[a] > c.lo[a]) --lo;
+            while (hi < 255 && q.origin[a] + hi * step[a] < c.hi[a]) ++hi;
+            q.lo[a][k] = uint8_t(lo);
+            q.hi[a][k] = uint8_t(hi);
+        }
+    }
+    for (int k = 0; k < count; ++k) {
+        const BVHNode &c = bvh.nodes[kids[k]];
+        if (c.count) {
+            uint32_t value = payload(c.offset, c.count);
+            if (value > PayloadMask) return -1;
+            q.child[k] = LeafBit | uint32_t(c.count - 1) << CountShift | value;
+        }
+        else {
+            int child = collapse(bvh, kids[k], payload);
+            if (child < 0) return -1;
+            q.child[k] = uint32_t(child);
+        }
+    }
+    nodes[index] = q;
+    return index;
+}
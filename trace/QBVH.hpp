@@ -0,0 +1,183 @@
+// compressed four-wide bounding volume hierarchy
+#ifndef QBVH_HPP
+#define QBVH_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "BVH.hpp"
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+// 56-byte node for up to four children. Child boxes are 8-bit offsets on a
+// per-axis power-of-two grid starting at the node's origin, rounded outward.
+struct QBVHNode {
+    float origin[3];        // low corner of the node's box
+    int8_t exponent[3];     // grid step per axis is 2^exponent
+    uint8_t count;          // children in use
+    uint8_t lo[3][4];       // child box low corners, in grid steps
+    uint8_t hi[3][4];       // child box high corners, in grid steps
+    uint32_t child[4];      // interior: node index; leaf: LeafBit | count-1 | payload
+};
+
+// Four-wide quantized hierarchy collapsed from a binary BVH, at about a
+// third of the node memory. Each leaf carries a 27-bit payload chosen by
+// the builder, such as a first slot or an offset into a compressed index
+// list, and a count of 1 to 16 items. A BVH whose payloads don't fit, past
+// 2^27 slots or index bytes, can't be compressed; build() says so and the
+// caller keeps the binary BVH.
+class QBVH {
+public: // public data
+    static const uint32_t LeafBit = 0x80000000u;
+    static const int CountShift = 27;
+    static const uint32_t PayloadMask = (1u << CountShift) - 1;
+
+    std::vector<QBVHNode> nodes;    // root first
+
+public: // build
+    // collapse bvh; payload(first, count) gives the value stored for each
+    // leaf of bvh. False, with no nodes, if a payload doesn't fit in 27
+    // bits, so the caller can keep the binary BVH instead
+    bool build(const BVH &bvh, const std::function<uint32_t(int, int)> &payload);
+
+    size_t bytes() const { return nodes.capacity() * sizeof(QBVHNode); }
+
+public: // queries
+    // as BVH::closest, with leaf(payload, count, far)
+    template <class Leaf>
+    void closest(const Ray &ray, Real &far, Leaf leaf) const;
+
+    // as BVH::any, with leaf(payload, count)
+    template <class Leaf>
+    bool any(const Ray &ray, Leaf leaf) const;
+
+private:
+    // node for the binary subtree at node of bvh, returning its index, or
+    // -1 if a payload doesn't fit
+    int collapse(const BVH &bvh, int node, const std::function<uint32_t(int, int)> &payload);
+
+    // 2^e as a float
+    static float power(int e);
+
+    // entry distance of each child hit before far, as a bit mask
+    static int hitChildren(const QBVHNode &n, const Real E[3], const Real inv[3],
+                           const int sign[3], Real near, Real far, Real tnear[4]);
+};
+
+inline float QBVH::power(int e)
+{
+    // exponents stay within the normal range, so this is just the bits
+    uint32_t bits = uint32_t(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+inline int QBVH::hitChildren(const QBVHNode &n, const Real E[3], const Real inv[3],
+                             const int sign[3], Real near, Real far, Real tnear[4])
+{
+    // ray distance at the grid origin and per grid step, per axis
+    Real base[3], dt[3];
+    for (int a = 0; a < 3; ++a) {
+        base[a] = (n.origin[a] - E[a]) * inv[a];
+        dt[a] = power(n.exponent[a]) * inv[a];
+    }
+
+    // the side each slab is entered on
+    const uint8_t (*side[2])[4] = { n.lo, n.hi };
+
+    int mask = 0;
+    for (int c = 0; c < n.count; ++c) {
+        Real t0 = near, t1 = far;
+        for (int a = 0; a < 3; ++a) {
+            Real ta = base[a] + side[sign[a]][a][c] * dt[a];
+            Real tb = base[a] + side[1 - sign[a]][a][c] * dt[a];
+            t0 = ta > t0 ? ta : t0;
+            t1 = tb < t1 ? tb : t1;
+        }
+        if (t0 <= t1) {
+            mask |= 1 << c;
+            tnear[c] = t0;
+        }
+    }
+    return mask;
+}
+
+template <class Leaf>
+void QBVH::closest(const Ray &ray, Real &far, Leaf leaf) const
+{
+    if (nodes.empty()) return;
+
+    Real E[3] = { ray.E[0], ray.E[1], ray.E[2] };
+    Real inv[3] = { ray.invD[0], ray.invD[1], ray.invD[2] };
+
+    // entries carry the distance they were hit at, to skip ones that a
+    // later hit has moved out of reach
+    struct Entry { uint32_t child; Real t; };
+    Entry stack[3 * BVH::MaxDepth + 4];
+    int top = 0;
+    stack[top++] = Entry{ 0, ray.near };
+
+    while (top > 0) {
+        Entry e = stack[--top];
+        if (e.t > far) continue;
+        if (e.child & LeafBit) {
+            leaf(e.child & PayloadMask, int((e.child >> CountShift) & 15) + 1, far);
+            continue;
+        }
+
+        const QBVHNode &n = nodes[e.child];
+        Real tnear[4];
+        int mask = hitChildren(n, E, inv, ray.sign, ray.near, far, tnear);
+
+        // push far to near so the nearest child is visited first
+        int order[4], hits = 0;
+        for (int c = 0; c < n.count; ++c) {
+            if (!(mask >> c & 1)) continue;
+            int k = hits++;
+            while (k > 0 && tnear[order[k-1]] < tnear[c]) {
+                order[k] = order[k-1];
+                --k;
+            }
+            order[k] = c;
+        }
+        for (int k = 0; k < hits; ++k)
+            stack[top++] = Entry{ n.child[order[k]], tnear[order[k]] };
+    }
+}
+
+template <class Leaf>
+bool QBVH::any(const Ray &ray, Leaf leaf) const
+{
+    if (nodes.empty()) return false;
+
+    Real E[3] = { ray.E[0], ray.E[1], ray.E[2] };
+    Real inv[3] = { ray.invD[0], ray.invD[1], ray.invD[2] };
+
+    uint32_t stack[3 * BVH::MaxDepth + 4];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        uint32_t child = stack[--top];
+        if (child & LeafBit) {
+            if (leaf(child & PayloadMask, int((child >> CountShift) & 15) + 1))
+                return true;
+            continue;
+        }
+
+        const QBVHNode &n = nodes[child];
+        Real tnear[4];
+        int mask = hitChildren(n, E, inv, ray.sign, ray.near, ray.far, tnear);
+        for (int c = 0; c < n.count; ++c)
+            if (mask >> c & 1)
+                stack[top++] = n.child[c];
+    }
+    return false;
+}
+
+#endif
@@ -11,28 +11,39 @@ class Ray {
 public: // public data
     Vec3 E;         // ray start point
     Vec3 D;     // ray direction
-    float near;         // closest t to ray origin to count as intersection
-    float far;          // farthest t to count as intersection
+    Real near;         // closest t to ray origin to count as intersection
+    Real far;          // farthest t to count as intersection
     int bounces;        // number of bounces allowed for ray
-    float influence;    // maximum contribution of this ray to the final image
+    Real influence;    // maximum contribution of this ray to the final image
+    Real cutoff;       // influence below which rays it spawns aren't traced
+    Real width;        // width of the pixel's footprint at E, for texture filtering
+    Real spread;       // growth of that width per unit of distance along the ray
 
     // derived, for intersection testing
-    float D_dot_D;
+    Real D_dot_D;
+    Vec3 invD;      // 1/D per axis, infinite along axes D is parallel to
+    int sign[3];    // 1 where D is negative, including -0, else 0
 
 public: // constructors
     Ray(const Vec3 _start, const Vec3 _direction, 
-        float _near=1e-4, float _far=INFINITY,
-        int _bounces=0, float _influence=0) 
+        Real _near=Real(1e-4), Real _far=INFINITY,
+        int _bounces=0, Real _influence=0) 
     {
         E = _start;
         D = _direction;
         D_dot_D = dot(D,D);
+        invD = Vec3(1 / D[0], 1 / D[1], 1 / D[2]);
+        for (int a = 0; a < 3; ++a)
+            sign[a] = invD[a] < 0;
 
         near = _near;
         far = _far;
 
         bounces = _bounces;
         influence = _influence;
+        cutoff = 0;
+
+        width = spread = 0;
     }
 };
 
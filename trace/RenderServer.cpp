@@ -0,0 +1,374 @@
+// implementation code for RenderServer class
+// reads request lines, renders them and streams images back in order
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "RenderServer.hpp"
+
+// other classes used directly in the implementation
+#include "Object.hpp"
+#include "Profile.hpp"
+#include "Renderer.hpp"
+#include "Reprojection.hpp"
+#include "World.hpp"
+
+// system includes
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+// answers waiting to be sent; rendering stops this far ahead of the sender
+static const size_t MaxQueued = 4;
+
+// largest image a request may ask for, so one line can't exhaust memory
+static const int MaxSide = 16384;
+static const long long MaxPixels = 64LL << 20;
+
+// effects a request may turn on and off; the rest are fixed at load time
+static const struct { const char *name; unsigned int bit; } EffectNames[] = {
+    { "ambient",  World::AMBIENT },
+    { "diffuse",  World::DIFFUSE },
+    { "specular", World::SPECULAR },
+    { "shadow",   World::SHADOW },
+    { "reflect",  World::REFLECT },
+    { "refract",  World::REFRACT },
+};
+
+// one answer on its way out
+struct Answer {
+    std::string header;
+    std::vector<unsigned char> body;
+    std::string id;
+    int width, height;
+    Clock::time_point received;
+    double rendered;            // milliseconds
+    double reused;              // fraction of primary hits, or -1
+};
+
+// one line without its newline; false at end of input
+static bool readLine(FILE *in, std::string &line)
+{
+    line.clear();
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), in)) {
+        line += buffer;
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+static double millis(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+RenderServer::RenderServer(World &_world, Renderer &_renderer)
+    : world(_world), renderer(_renderer), served(0)
+{
+    initial.width = world.width;
+    initial.height = world.height;
+    for (int c = 0; c < 4; ++c)
+        initial.crop[c] = 0;
+    initial.eye = world.eye;
+    initial.look = world.look;
+    initial.up = world.up;
+    initial.xfov = world.xfov;
+    initial.yfov = world.yfov;
+    initial.maxdepth = world.maxdepth;
+    initial.cutoff = world.cutoff;
+    initial.effects = world.effects;
+    initial.samples = renderer.samples;
+    initial.budget = renderer.timeBudget * 1000;
+    current = initial;
+}
+
+bool RenderServer::parse(const std::string &line, Settings &settings,
+                         std::string &id, std::string &error) const
+{
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word) {
+        bool ok = true;
+        if (word == "id")
+            ok = bool(words >> id);
+        else if (word == "size") {
+            ok = words >> settings.width >> settings.height &&
+                 settings.width > 0 && settings.height > 0;
+            if (ok && (settings.width > MaxSide || settings.height > MaxSide ||
+                       (long long)settings.width * settings.height > MaxPixels)) {
+                error = "size " + std::to_string(settings.width) + " " +
+                    std::to_string(settings.height) + " is over the limit of " +
+                    std::to_string(MaxSide) + " on a side and " +
+                    std::to_string(MaxPixels) + " pixels";
+                return false;
+            }
+        }
+        else if (word == "crop")
+            ok = bool(words >> settings.crop[0] >> settings.crop[1]
+                            >> settings.crop[2] >> settings.crop[3]);
+        else if (word == "eye")
+            ok = bool(words >> settings.eye);
+        else if (word == "look")
+            ok = bool(words >> settings.look);
+        else if (word == "up")
+            ok = bool(words >> settings.up);
+        else if (word == "fov")
+            ok = words >> settings.xfov >> settings.yfov &&
+                 settings.xfov > 0 && settings.yfov > 0;
+        else if (word == "maxdepth")
+            ok = words >> settings.maxdepth && settings.maxdepth >= 0;
+        else if (word == "cutoff")
+            ok = bool(words >> settings.cutoff);
+        else if (word == "samples")
+            ok = words >> settings.samples && settings.samples >= 0;
+        else if (word == "budget")
+            ok = words >> settings.budget && settings.budget >= 0;
+        else if (word == "reset")
+            settings = initial;
+        else if (word[0] == '+' || word[0] == '-') {
+            ok = false;
+            for (const auto &effect : EffectNames)
+                if (word.compare(1, std::string::npos, effect.name) == 0) {
+                    if (word[0] == '+')
+                        settings.effects |= effect.bit;
+                    else
+                        settings.effects &= ~effect.bit;
+                    ok = true;
+                }
+        }
+        else
+            ok = false;
+
+        if (!ok) {
+            error = "bad request word '" + word + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RenderServer::serve(FILE *in, FILE *out)
+{
+    // the sender writes finished answers while the next one renders
+    std::deque<Answer> queue;
+    std::mutex lock;
+    std::condition_variable changed;
+    bool done = false, failed = false;
+
+    std::thread sender([&]{
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            changed.wait(guard, [&]{ return done || !queue.empty(); });
+            if (queue.empty())
+                return;
+            Answer answer = std::move(queue.front());
+            queue.pop_front();
+            changed.notify_all();
+            guard.unlock();
+
+            PROFILE_SCOPE("output");
+            bool ok = fwrite(answer.header.data(), 1, answer.header.size(), out)
+                          == answer.header.size() &&
+                      fwrite(answer.body.data(), 1, answer.body.size(), out)
+                          == answer.body.size() &&
+                      fflush(out) == 0;
+            if (answer.width > 0)
+                std::cout << "request " << answer.id << ": " << answer.width << 'x'
+                    << answer.height << ", " << millis(Clock::now() - answer.received)
+                    << " ms from request to answer, " << answer.rendered
+                    << " ms rendering"
+                    << (answer.reused >= 0 ? ", " + std::to_string(int(100 * answer.reused))
+                                             + "% of primary hits reused" : std::string())
+                    << '\n';
+
+            guard.lock();
+            if (!ok)
+                failed = true;
+        }
+    });
+
+    auto send = [&](Answer &&answer) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&]{ return queue.size() < MaxQueued; });
+        queue.push_back(std::move(answer));
+        changed.notify_all();
+    };
+
+    bool shutdown = false;
+    std::string line;
+    while (readLine(in, line)) {
+        Clock::time_point received = Clock::now();
+        if (line == "quit")
+            break;
+        if (line == "shutdown") {
+            shutdown = true;
+            break;
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos)
+            continue;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (failed) break;      // client stopped reading
+        }
+
+        Answer answer;
+        answer.received = received;
+        answer.width = answer.height = 0;
+        answer.id = std::to_string(served);
+
+        Settings settings = current;
+        std::string error;
+        parse(line, settings, answer.id, error);
+
+        int x0 = 0, y0 = 0, x1 = settings.width, y1 = settings.height;
+        if (error.empty() && (settings.crop[2] > settings.crop[0] ||
+                              settings.crop[3] > settings.crop[1])) {
+            x0 = std::max(settings.crop[0], 0);  x1 = std::min(settings.crop[2], x1);
+            y0 = std::max(settings.crop[1], 0);  y1 = std::min(settings.crop[3], y1);
+            if (x1 <= x0 || y1 <= y0)
+                error = "crop window is outside the image";
+        }
+        if (!error.empty()) {
+            answer.header = "error " + answer.id + ' ' + error + '\n';
+            send(std::move(answer));
+            ++served;
+            continue;
+        }
+        current = settings;
+
+        // bring the world and renderer up to date
+        world.width = settings.width;
+        world.height = settings.height;
+        world.eye = settings.eye;
+        world.look = settings.look;
+        world.up = settings.up;
+        world.xfov = settings.xfov;
+        world.yfov = settings.yfov;
+        world.setView();
+        world.maxdepth = settings.maxdepth;
+        world.cutoff = settings.cutoff;
+        if (settings.effects != world.effects) {
+            world.effects = settings.effects;
+            world.shade = Object::shadeKernel(world.effects);
+        }
+        renderer.samples = settings.samples;
+        renderer.timeBudget = settings.budget / 1000;
+
+        // binary PPM: header, then rows straight from the framebuffer
+        int width = x1 - x0, height = y1 - y0;
+        std::string ppm = "P6\n" + std::to_string(width) + ' ' +
+                          std::to_string(height) + "\n255\n";
+        answer.body.resize(ppm.size() + size_t(width) * height * 3);
+        memcpy(answer.body.data(), ppm.data(), ppm.size());
+
+        Clock::time_point start = Clock::now();
+        if (renderer.reproject) {
+            PROFILE_SCOPE("reproject");
+            renderer.reproject->newFrame(world);
+        }
+        renderer.render((unsigned char (*)[3])(answer.body.data() + ppm.size()),
+                        width, x0, y0, x1, y1);
+        answer.rendered = millis(Clock::now() - start);
+        answer.reused = renderer.reproject ? renderer.reproject->reusedFraction() : -1;
+        answer.width = width;
+        answer.height = height;
+
+        std::ostringstream header;
+        header << "image " << answer.id << ' ' << width << ' ' << height << ' '
+            << answer.rendered << ' ' << answer.body.size() << '\n';
+        answer.header = header.str();
+        send(std::move(answer));
+        ++served;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        changed.notify_all();
+    }
+    sender.join();
+    return !shutdown;
+}
+
+bool RenderServer::listen(const char *path)
+{
+#ifndef _WIN32
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "socket path " << path << " is too long\n";
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+        ::listen(listener, 4) != 0) {
+        std::cerr << "can't listen on " << path << '\n';
+        if (listener >= 0) close(listener);
+        return false;
+    }
+
+    // a client that hangs up mid-answer is a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    std::cout << "serving on " << path << '\n' << std::flush;
+
+    bool more = true, ok = true;
+    while (more) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            int error = errno;
+            if (error == EINTR || error == ECONNABORTED)
+                continue;
+
+            // out of descriptors or memory: wait for some to be freed
+            std::cerr << "accept: " << strerror(error) << '\n';
+            if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        FILE *in = fdopen(connection, "rb");
+        if (!in)
+            close(connection);
+        FILE *out = in ? fdopen(dup(connection), "wb") : nullptr;
+        if (in && out)
+            more = serve(in, out);
+        if (in) fclose(in);
+        if (out) fclose(out);
+    }
+    close(listener);
+    unlink(path);
+    std::cout << "served " << served << " request" << (served == 1 ? "" : "s") << '\n';
+    return ok;
+#else
+    std::cerr << "-serve needs UNIX sockets here; use -serve - for stdin\n";
+    return false;
+#endif
+}
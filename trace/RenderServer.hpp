@@ -0,0 +1,77 @@
+// long-running render loop over one loaded scene
+#ifndef RENDERSERVER_HPP
+#define RENDERSERVER_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <stdio.h>
+#include <string>
+
+// classes we only use by pointer or reference
+class World;
+class Renderer;
+
+// Keeps the parsed scene, its acceleration structure and the renderer
+// between requests. Each request is one line of words, applied in order
+// to settings that carry over to later requests:
+//   id TAG                 echoed back with the image
+//   size W H               image size, at most 16384 on a side and 64M pixels
+//   crop X0 Y0 X1 Y1       render only this region; all zeros for everything
+//   eye X Y Z, look X Y Z, up X Y Z, fov XDEG YDEG
+//   maxdepth N, cutoff C   recursion limits
+//   samples N              path-traced samples per pixel, 0 for Whitted
+//   budget MS              time budget per image, 0 for fixed quality
+//   +EFFECT, -EFFECT       ambient, diffuse, specular, shadow, reflect, refract
+//   reset                  back to the scene file's settings
+// and answered with
+//   image ID W H RENDER_MS BYTES\n followed by BYTES of binary PPM, or
+//   error ID MESSAGE\n
+// A line of just "quit" ends the connection and "shutdown" the server.
+//
+// Clients may send any number of requests without waiting for answers.
+// Answers come back in request order; while one is being sent the next
+// is already rendering.
+class RenderServer {
+public: // constructors
+    // settings start out as world's
+    RenderServer(World &_world, Renderer &_renderer);
+
+public: // serving
+    // answer requests from in on out until end of input, quit or shutdown;
+    // false after shutdown
+    bool serve(FILE *in, FILE *out);
+
+    // serve one connection at a time on a UNIX socket at path until a
+    // client sends shutdown; false if it can't listen there or accepting
+    // fails for a reason other than running short of descriptors
+    bool listen(const char *path);
+
+private:
+    // what a request can change
+    struct Settings {
+        int width, height;
+        int crop[4];
+        Vec3 eye, look, up;
+        Real xfov, yfov;
+        int maxdepth;
+        Real cutoff;
+        unsigned int effects;
+        int samples;
+        double budget;          // milliseconds
+    };
+
+    // apply the words of one request line to settings; false with a
+    // message on any word it doesn't understand
+    bool parse(const std::string &line, Settings &settings,
+               std::string &id, std::string &error) const;
+
+private: // private data
+    World &world;
+    Renderer &renderer;
+    Settings initial, current;
+    int served;                 // requests answered so far
+};
+
+#endif
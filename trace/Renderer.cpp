@@ -0,0 +1,554 @@
+// implementation code for Renderer class
+// splits image regions into tiles and traces them on a pool of threads
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Renderer.hpp"
+
+// other classes used directly in the implementation
+#include "World.hpp"
+#include "Accel.hpp"
+#include "Intersection.hpp"
+#include "LoadBalance.hpp"
+#include "Numa.hpp"
+#include "ObjectList.hpp"
+#include "PathTracer.hpp"
+#include "Profile.hpp"
+#include "Reprojection.hpp"
+
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <cmath>
+#include <memory>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+Renderer::Renderer(const World &_world, const Accel &_tree)
+    : world(_world), tree(_tree), tileSize(32), order(HILBERT), samples(0),
+      timeBudget(0), counts(nullptr), reproject(nullptr), balance(nullptr), numa(nullptr), reachedDepth(0), topDepth(0), reachedCutoff(0), fullTiles(0), reachedSamples(0),
+      partial(false), nodeTiles(0), remoteTiles(0), noiseSum(0), noisePixels(0),
+      qualityRenders(0), qualityTiles(0), qualityFullTiles(0)
+{
+    threads = std::thread::hardware_concurrency();
+    if (threads < 1 || !(world.effects & World::PARALLEL))
+        threads = 1;
+}
+
+// primary ray through pixel (i,j) at (dx,dy) across it
+Ray Renderer::primaryRay(int i, int j, Real dx, Real dy) const
+{
+    Real us = world.left + (world.right  - world.left) * (i+dx)/world.width;
+    Real vs = world.top  + (world.bottom - world.top ) * (j+dy)/world.height;
+    Vec3 dir = -world.dist * world.w + us * world.u + vs * world.v;
+
+    Ray ray(world.eye, dir, Real(1e-4), INFINITY, world.maxdepth, 1);
+    ray.cutoff = world.cutoff;
+
+    // a pixel's width on the view plane, over the distance to the plane
+    ray.spread = (world.right - world.left) / (world.width * world.dist);
+    return ray;
+}
+
+// trace one pixel
+Vec3 Renderer::tracePixel(int i, int j) const
+{
+    Ray ray = primaryRay(i, j);
+    return tree.trace(ray).color(world, ray);
+}
+
+// position of (x,y) along a Morton curve: bits interleaved ...y1 x1 y0 x0
+static unsigned int mortonIndex(unsigned int x, unsigned int y)
+{
+    unsigned int d = 0;
+    for (int b = 0; b < 16; ++b)
+        d |= (x >> b & 1) << (2*b) | (y >> b & 1) << (2*b + 1);
+    return d;
+}
+
+// position of (x,y) along a Hilbert curve filling an n x n square, n a
+// power of two
+static unsigned int hilbertIndex(unsigned int n, unsigned int x, unsigned int y)
+{
+    unsigned int d = 0;
+    for (unsigned int s = n / 2; s > 0; s /= 2) {
+        unsigned int rx = (x & s) > 0, ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so the curve inside it starts and ends right
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// curve over the smallest power-of-two square covering the grid, keeping
+// only the cells inside it
+std::vector<int> Renderer::curve(Order order, int width, int height)
+{
+    std::vector<int> cells(width * height);
+    for (int c = 0; c < width * height; ++c)
+        cells[c] = c;
+    if (order == ROWS) return cells;
+
+    unsigned int n = 1;
+    while (n < unsigned(std::max(width, height)))
+        n *= 2;
+    std::vector<unsigned int> key(width * height);
+    for (int c = 0; c < width * height; ++c) {
+        unsigned int x = c % width, y = c / width;
+        key[c] = order == MORTON ? mortonIndex(x, y) : hilbertIndex(n, x, y);
+    }
+    std::sort(cells.begin(), cells.end(), [&](int a, int b) { return key[a] < key[b]; });
+    return cells;
+}
+
+// render a region in tiles
+void Renderer::render(unsigned char (*pixels)[3], int stride,
+                      int x0, int y0, int x1, int y1) const
+{
+    PROFILE_SCOPE("render");
+    if (timeBudget > 0) {
+        renderBudget(pixels, stride, x0, y0, x1, y1);
+        return;
+    }
+
+    if (samples > 0) {
+        std::vector<float> sum;
+        addPaths(sum, x0, y0, x1, y1, 0, samples, Clock::time_point::max());
+        resolvePaths(sum, pixels, stride, x1 - x0, y1 - y0);
+        reachedPaths(samples);
+    }
+    else {
+        renderTiles(pixels, stride, x0, y0, x1, y1, world.maxdepth, world.cutoff,
+                    Clock::time_point::max());
+        int tiles = ((x1 - x0 + tileSize - 1) / tileSize) * ((y1 - y0 + tileSize - 1) / tileSize);
+        reachedTiles(world.maxdepth, world.maxdepth, world.cutoff, tiles, tiles);
+    }
+}
+
+void Renderer::reachedTiles(int lowDepth, int highDepth, Real cutoff, int tiles, int full) const
+{
+    bool first = qualityRenders++ == 0;
+    reachedDepth = first ? lowDepth : std::min(reachedDepth, lowDepth);
+    topDepth = first ? highDepth : std::max(topDepth, highDepth);
+    reachedCutoff = first ? cutoff : std::max(reachedCutoff, cutoff);
+    qualityTiles += tiles;
+    qualityFullTiles += full;
+    fullTiles = qualityTiles ? double(qualityFullTiles) / qualityTiles : 0;
+}
+
+void Renderer::reachedPaths(int samples) const
+{
+    bool first = qualityRenders++ == 0;
+    reachedSamples = first ? samples : std::min(reachedSamples, samples);
+}
+
+// Paths add samples in batches sized by the time per sample so far, never
+// cutting the first one short so there is always a whole image. Whitted
+// rendering is one pass whose tiles each pick a reflection depth and
+// cutoff from how fast tiles have been going.
+void Renderer::renderBudget(unsigned char (*pixels)[3], int stride,
+                            int x0, int y0, int x1, int y1) const
+{
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start +
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeBudget));
+
+    if (samples > 0) {
+        // one sample everywhere, then batches sized by the measured time
+        // per sample, up to the samples asked for
+        std::vector<float> sum;
+        addPaths(sum, x0, y0, x1, y1, 0, 1, Clock::time_point::max());
+        int done = 1;
+        while (done < samples) {
+            double spent = std::chrono::duration<double>(Clock::now() - start).count();
+            double left = std::chrono::duration<double>(deadline - Clock::now()).count();
+            // samples that fit in the time left, before converting, as
+            // spent can be 0 on a coarse clock and left negative when late
+            double fit = spent > 0 ? std::max(0.0, left) / (spent / done) : samples;
+            int batch = int(std::min(fit, double(std::min(samples - done, done))));
+            if (batch < 1)
+                break;
+            if (!addPaths(sum, x0, y0, x1, y1, done, batch, deadline)) {
+                partial = true;
+                break;
+            }
+            done += batch;
+        }
+        resolvePaths(sum, pixels, stride, x1 - x0, y1 - y0);
+        reachedPaths(done);
+        return;
+    }
+
+    // reflection depths 0, 1, 2, 4, ... up to maxdepth, each with a cutoff
+    // that lets fewer faint rays through at low depth
+    Budget budget;
+    for (int d = 0; ; d = std::max(1, 2 * d)) {
+        d = std::min(d, world.maxdepth);
+        budget.depths.push_back(d);
+        budget.cutoffs.push_back(d == world.maxdepth ? world.cutoff :
+                                 std::max(world.cutoff, Real(0.1) / std::max(d, 1)));
+        if (d == world.maxdepth) break;
+    }
+    budget.seconds.assign(budget.depths.size(), 0);
+    budget.tiles.assign(budget.depths.size(), 0);
+    budget.deadline = deadline;
+    budget.lowest = int(budget.depths.size()) - 1;
+    budget.highest = 0;
+
+    renderTiles(pixels, stride, x0, y0, x1, y1, world.maxdepth, world.cutoff,
+                Clock::time_point::max(), &budget);
+    int tiles = 0;
+    for (int n : budget.tiles) tiles += n;
+    reachedTiles(budget.depths[budget.lowest], budget.depths[budget.highest],
+                 budget.cutoffs[budget.lowest], tiles, budget.tiles.back());
+}
+
+// Each tile may spend its share of the time left, over the workers; it
+// gets the highest step whose tiles have cost no more than that so far.
+// A step nobody has tried yet is guessed at twice the one below it, and
+// the very first tiles use the lowest step to have something to go by.
+int Renderer::Budget::choose(int workers)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    double left = std::chrono::duration<double>(deadline - Clock::now()).count();
+    double share = left * workers / std::max(tilesLeft, 1);
+    --tilesLeft;
+
+    int level = 0;
+    double guess = 0;
+    for (size_t k = 0; k < depths.size(); ++k) {
+        double cost = tiles[k] ? seconds[k] / tiles[k] : 2 * guess;
+        if (k > 0 && (tiles[0] == 0 || cost > share)) break;
+        level = int(k);
+        guess = cost;
+    }
+    lowest = std::min(lowest, level);
+    highest = std::max(highest, level);
+    return level;
+}
+
+void Renderer::Budget::record(int level, double took)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    seconds[level] += took;
+    ++tiles[level];
+}
+
+// each worker grabs the next unclaimed tile until none are left or the
+// deadline passes; false if any tile was skipped
+bool Renderer::renderTiles(unsigned char (*pixels)[3], int stride,
+                           int x0, int y0, int x1, int y1,
+                           int maxdepth, Real cutoff, Clock::time_point deadline,
+                           Budget *budget) const
+{
+    int tilesX = (x1 - x0 + tileSize - 1) / tileSize;
+    int tilesY = (y1 - y0 + tileSize - 1) / tileSize;
+    int tileCount = tilesX * tilesY;
+    bool timed = deadline != Clock::time_point::max();
+
+    // consecutive tiles, and consecutive pixels in a tile, are neighbors in
+    // the image, so rays close in time visit the same parts of the scene
+    std::vector<int> tileOrder = curve(order, tilesX, tilesY);
+    std::vector<int> pixelOrder = curve(order, tileSize, tileSize);
+
+    // never spawn more workers than there are tiles
+    int workers = std::min(threads, tileCount);
+    if (budget)
+        budget->tilesLeft = tileCount;
+
+    // each node's tiles are its band of rows, in the same order; a worker
+    // takes its own node's tiles, then helps the next nodes
+    int nodeCount = numa ? int(numa->nodes.size()) : 1;
+    std::vector<std::vector<int> > nodeOrder(nodeCount);
+    for (int cell : tileOrder)
+        nodeOrder[(long long)(cell / tilesX) * nodeCount / tilesY].push_back(cell);
+    std::unique_ptr<std::atomic<int>[]> nextTile(new std::atomic<int>[nodeCount]);
+    for (int n = 0; n < nodeCount; ++n)
+        nextTile[n] = 0;
+    std::atomic<long long> remote(0);
+
+    std::atomic<bool> late(false);
+    if (balance)
+        balance->begin(x0, y0, x1, y1);
+    Clock::time_point started = Clock::now();
+    auto worker = [&](int w) {
+        RayCounts::Scope counting(counts);
+        LoadBalance::Worker timing = LoadBalance::Worker();
+
+        // on its node's CPU, with its node's copy of the structure if any
+        int home = numa ? numa->nodeOf(w, workers) : 0;
+        if (numa)
+            numa->pin(w, workers);
+        const Accel *local = numa ? numa->replica(home) : nullptr;
+        World::Replica replica(local);
+        const Accel &accel = local ? *local : tree;
+        int from = 0;   // nodes past home whose tiles are taken
+
+        // a tile's primary rays go to the structure as one batch, less
+        // any whose hit carries over from the last frame
+        std::vector<Ray> rays, pending;
+        std::vector<Intersection> hits(tileSize * tileSize), pendingHits(tileSize * tileSize);
+        std::vector<int> where, pendingAt;
+        for (;;) {
+            int cell = -1;
+            for (; from < nodeCount && cell < 0; ++from) {
+                int n = (home + from) % nodeCount;
+                int at = nextTile[n]++;
+                if (at < int(nodeOrder[n].size())) {
+                    cell = nodeOrder[n][at];
+                    break;
+                }
+            }
+            if (cell < 0)
+                break;
+            if (from > 0)
+                ++remote;
+            if (timed && Clock::now() > deadline) {
+                late = true;
+                break;
+            }
+            PROFILE_SCOPE("tile");
+            int tx = x0 + (cell % tilesX) * tileSize;
+            int ty = y0 + (cell / tilesX) * tileSize;
+
+            // rays carry this tile's recursion limits
+            int level = budget ? budget->choose(std::max(workers, 1)) : 0;
+            int depth = budget ? budget->depths[level] : maxdepth;
+            Real tileCutoff = budget ? budget->cutoffs[level] : cutoff;
+            Clock::time_point tileStart = Clock::now();
+
+            rays.clear();
+            where.clear();
+            for (int p : pixelOrder) {
+                int i = tx + p % tileSize, j = ty + p / tileSize;
+                if (i >= x1 || j >= y1) continue;   // past the edge of the region
+                rays.push_back(primaryRay(i, j));
+                rays.back().bounces = depth;
+                rays.back().cutoff = tileCutoff;
+                where.push_back(p);
+            }
+            if (reproject) {
+                PROFILE_SCOPE("trace");
+                pending.clear();
+                pendingAt.clear();
+                for (size_t r = 0; r < rays.size(); ++r) {
+                    int i = tx + where[r] % tileSize, j = ty + where[r] / tileSize;
+                    if (!reproject->reuse(i, j, rays[r], hits[r])) {
+                        pending.push_back(rays[r]);
+                        pendingAt.push_back(int(r));
+                    }
+                }
+                accel.traceBatch(pending.data(), pendingHits.data(), int(pending.size()));
+                for (size_t q = 0; q < pending.size(); ++q)
+                    hits[pendingAt[q]] = pendingHits[q];
+                for (size_t r = 0; r < rays.size(); ++r)
+                    reproject->record(tx + where[r] % tileSize, ty + where[r] / tileSize,
+                                      rays[r], hits[r]);
+                reproject->count(int(rays.size() - pending.size()), int(pending.size()));
+            }
+            else {
+                PROFILE_SCOPE("trace");
+                accel.traceBatch(rays.data(), hits.data(), int(rays.size()));
+            }
+
+            PROFILE_SCOPE("shade");
+            for (size_t r = 0; r < rays.size(); ++r) {
+                int i = tx + where[r] % tileSize, j = ty + where[r] / tileSize;
+                Vec3 col = hits[r].color(world, rays[r]);
+                unsigned char *out = pixels[(j - y0) * stride + (i - x0)];
+                out[0] = col.r();
+                out[1] = col.g();
+                out[2] = col.b();
+            }
+            double took = std::chrono::duration<double>(Clock::now() - tileStart).count();
+            if (budget)
+                budget->record(level, took);
+            if (balance) {
+                timing.busy += took;
+                timing.x.push_back(tx);
+                timing.y.push_back(ty);
+                timing.seconds.push_back(float(took));
+            }
+        }
+        if (balance) {
+            timing.finished = std::chrono::duration<double>(Clock::now() - started).count();
+            balance->add(w, timing);
+        }
+    };
+
+    // pinned workers get threads of their own, leaving the caller free
+    if (workers <= 1 && !numa)
+        worker(0);
+    else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < workers; ++t)
+            pool.push_back(std::thread(worker, t));
+        for (auto &thread : pool)
+            thread.join();
+    }
+    if (balance)
+        balance->finish(workers, std::chrono::duration<double>(Clock::now() - started).count());
+    if (numa) {
+        nodeTiles += tileCount;
+        remoteTiles += remote;
+    }
+    return !late;
+}
+
+// each node's band of tile rows, as renderTiles splits them
+void Renderer::firstTouch(unsigned char (*pixels)[3], int stride,
+                          int x0, int y0, int x1, int y1) const
+{
+    int nodeCount = numa ? int(numa->nodes.size()) : 1;
+    int tilesY = (y1 - y0 + tileSize - 1) / tileSize;
+    std::vector<std::thread> touchers;
+    for (int n = 0; n < nodeCount; ++n)
+        touchers.push_back(std::thread([=]{
+            if (numa)
+                numa->pinToNode(n);
+            int rowLo = std::min(y1 - y0, int((n * tilesY + nodeCount - 1) / nodeCount) * tileSize);
+            int rowHi = std::min(y1 - y0, int(((n + 1) * tilesY + nodeCount - 1) / nodeCount) * tileSize);
+            for (int row = rowLo; row < rowHi; ++row)
+                memset(pixels[row * stride], 0, size_t(x1 - x0) * 3);
+        }));
+    for (auto &toucher : touchers)
+        toucher.join();
+}
+
+// Work is one sample for every pixel of one tile, so threads spread over
+// samples as well as tiles. Each thread adds its paths into its own float
+// buffer over the region, with no locking; the buffers are then added to
+// sum. Per pixel the buffers keep the color sum, the sum of squared
+// brightness for the spread of the samples, and the sample count, which
+// differs between tiles if the deadline cuts a batch short.
+bool Renderer::addPaths(std::vector<float> &sum, int x0, int y0, int x1, int y1,
+                        int first, int count, Clock::time_point deadline) const
+{
+    int width = x1 - x0, height = y1 - y0;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    int tileCount = tilesX * tilesY;
+    long long workCount = (long long)tileCount * count;
+    bool timed = deadline != Clock::time_point::max();
+    sum.resize(size_t(width) * height * 5, 0.f);
+
+    std::vector<int> tileOrder = curve(order, tilesX, tilesY);
+    std::vector<int> pixelOrder = curve(order, tileSize, tileSize);
+    PathTracer tracer(world);
+
+    int workers = int(std::max(1LL, std::min<long long>(threads, workCount)));
+    std::vector<std::vector<float> > sums(workers);
+    std::atomic<long long> nextWork(0);
+    std::atomic<bool> late(false);
+    if (balance)
+        balance->begin(x0, y0, x1, y1);
+    Clock::time_point started = Clock::now();
+    auto worker = [&](int w) {
+        RayCounts::Scope counting(counts);
+        LoadBalance::Worker timing = LoadBalance::Worker();
+
+        // pinned first, so the worker's buffer is on its node
+        if (numa)
+            numa->pin(w, workers);
+        World::Replica replica(numa ? numa->replica(numa->nodeOf(w, workers)) : nullptr);
+        std::vector<float> &part = sums[w];
+        part.assign(sum.size(), 0.f);
+        for (long long work = nextWork++; work < workCount; work = nextWork++) {
+            if (timed && Clock::now() > deadline) {
+                late = true;
+                break;
+            }
+            PROFILE_SCOPE("path tile");
+            Clock::time_point tileStart = Clock::now();
+            int tile = int(work % tileCount), sample = first + int(work / tileCount);
+            int tx = (tileOrder[tile] % tilesX) * tileSize;
+            int ty = (tileOrder[tile] / tilesX) * tileSize;
+
+            for (int p : pixelOrder) {
+                int x = tx + p % tileSize, y = ty + p / tileSize;
+                if (x >= width || y >= height) continue;
+                int i = x0 + x, j = y0 + y;
+
+                Random random(uint64_t(j) * world.width + i, uint64_t(sample));
+                Real dx = random.next(), dy = random.next();
+                Vec3 col = tracer.radiance(primaryRay(i, j, dx, dy), random);
+
+                float *s = &part[(size_t(y) * width + x) * 5];
+                s[0] += float(col[0]);
+                s[1] += float(col[1]);
+                s[2] += float(col[2]);
+                float bright = float(col[0] + col[1] + col[2]) / 3;
+                s[3] += bright * bright;
+                s[4] += 1;
+            }
+            if (balance) {
+                double took = std::chrono::duration<double>(Clock::now() - tileStart).count();
+                timing.busy += took;
+                timing.x.push_back(x0 + tx);
+                timing.y.push_back(y0 + ty);
+                timing.seconds.push_back(float(took));
+            }
+        }
+        if (balance) {
+            timing.finished = std::chrono::duration<double>(Clock::now() - started).count();
+            balance->add(w, timing);
+        }
+    };
+
+    if (workers <= 1 && !numa)
+        worker(0);
+    else {
+        std::vector<std::thread> pool;
+        for (int w = 0; w < workers; ++w)
+            pool.push_back(std::thread(worker, w));
+        for (auto &thread : pool)
+            thread.join();
+    }
+    if (balance)
+        balance->finish(workers, std::chrono::duration<double>(Clock::now() - started).count());
+
+    for (int w = 0; w < workers; ++w)
+        for (size_t k = 0; k < sum.size(); ++k)
+            sum[k] += sums[w][k];
+    return !late;
+}
+
+// average each pixel's samples, and estimate the noise left in it
+void Renderer::resolvePaths(const std::vector<float> &sum, unsigned char (*pixels)[3],
+                            int stride, int width, int height) const
+{
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const float *s = &sum[(size_t(y) * width + x) * 5];
+            float n = std::max(s[4], 1.f);
+            Vec3 col(s[0] / n, s[1] / n, s[2] / n);
+            unsigned char *out = pixels[y * stride + x];
+            out[0] = col.r();
+            out[1] = col.g();
+            out[2] = col.b();
+
+            // one sample has no spread to measure
+            if (n > 1) {
+                double mean = (double(s[0]) + s[1] + s[2]) / (3.0 * n);
+                double variance = std::max(0.0, double(s[3]) / n - mean * mean);
+                noiseSum += variance / (n - 1);
+                noisePixels += 1;
+            }
+        }
+    }
+}
+
+double Renderer::noise() const
+{
+    return noisePixels > 0 ? 255 * std::sqrt(noiseSum / noisePixels) : 0;
+}
@@ -0,0 +1,144 @@
+// tiled image renderer
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Ray.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// classes we only use by pointer or reference
+class World;
+class Accel;
+struct RayCounts;
+class Reprojection;
+class LoadBalance;
+class Numa;
+
+// renders rectangular regions of the image as square tiles spread across a
+// fixed pool of worker threads, writing 8-bit RGB into a caller-owned buffer
+class Renderer {
+public: // public types
+    enum Order {                // order of tiles in the image and pixels in a tile
+        ROWS,                   // row by row
+        MORTON,                 // Z-order curve
+        HILBERT                 // Hilbert curve, no jumps between neighbors
+    };
+
+public: // public data
+    const World &world;         // scene and camera
+    const Accel &tree;          // acceleration structure for primary rays
+    int tileSize;               // tile edge length in pixels
+    int threads;                // number of worker threads
+    Order order;                // visiting order for tiles and pixels
+    int samples;                // path-traced samples per pixel, 0 for Whitted
+    double timeBudget;          // seconds per render() call, 0 for no limit
+    RayCounts *counts;          // where traces are counted, null for the process
+    Reprojection *reproject;    // last frame's primary hits to reuse, or null
+    LoadBalance *balance;       // where worker and tile times go, or null
+    const Numa *numa;           // nodes to pin workers to and split tiles by, or null
+
+    // worst quality reached over every render() so far, such as the bands
+    // of one image: lowest and highest maxdepth over the tiles, the highest
+    // cutoff and the fraction of tiles at full quality for Whitted, fewest
+    // samples per pixel for paths, and whether a batch of samples was cut
+    // short
+    mutable int reachedDepth, topDepth;
+    mutable Real reachedCutoff;
+    mutable double fullTiles;
+    mutable int reachedSamples;
+    mutable bool partial;
+
+    // with numa, tiles rendered so far and how many of those were taken
+    // from another node's rows once a node's own ran out
+    mutable long long nodeTiles, remoteTiles;
+
+    // path tracing convergence over everything rendered so far: summed
+    // squared standard error of each pixel's mean, and pixels counted
+    mutable double noiseSum;
+    mutable double noisePixels;
+
+public: // constructors
+    Renderer(const World &_world, const Accel &_tree);
+
+public: // computational members
+    // primary ray through pixel (i,j), at (dx,dy) across it; the center
+    // by default
+    Ray primaryRay(int i, int j, Real dx = Real(0.5), Real dy = Real(0.5)) const;
+
+    // color seen through pixel (i,j)
+    Vec3 tracePixel(int i, int j) const;
+
+    // render pixels [x0,x1) x [y0,y1) into pixels, where the pixel at
+    // (x0,y0) is pixels[0] and rows are stride pixels apart
+    void render(unsigned char (*pixels)[3], int stride,
+                int x0, int y0, int x1, int y1) const;
+
+    // With numa, each node's workers render their own band of the
+    // region's rows first. Write zeros to each band from a thread on its
+    // node, so fresh pixels memory gets its pages there; call before the
+    // first render into it.
+    void firstTouch(unsigned char (*pixels)[3], int stride,
+                    int x0, int y0, int x1, int y1) const;
+
+    // cells of a width x height grid as x + y*width, in the given order
+    static std::vector<int> curve(Order order, int width, int height);
+
+    // root mean square standard error of path-traced pixels, 0-255 scale,
+    // over renders of more than one sample
+    double noise() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Whitted quality steps and what their tiles have cost so far, shared
+    // by the workers of one budgeted render
+    struct Budget {
+        std::vector<int> depths;        // maxdepth of each step, cheapest first
+        std::vector<Real> cutoffs;
+        std::vector<double> seconds;    // time spent on tiles of each step
+        std::vector<int> tiles;         // and how many
+        Clock::time_point deadline;
+        int tilesLeft;
+        int lowest, highest;            // steps used
+        std::mutex lock;
+
+        // step for the next tile, with workers rendering at once
+        int choose(int workers);
+        void record(int level, double took);
+    };
+
+    // fold one render's Whitted tiles, or path samples, into the quality
+    // reached so far
+    void reachedTiles(int lowDepth, int highDepth, Real cutoff, int tiles, int full) const;
+    void reachedPaths(int samples) const;
+    mutable int qualityRenders;             // renders folded in so far
+    mutable long long qualityTiles, qualityFullTiles;
+
+    // render as above, adapting quality to finish within timeBudget
+    void renderBudget(unsigned char (*pixels)[3], int stride,
+                      int x0, int y0, int x1, int y1) const;
+
+    // Whitted tiles with the given recursion limits, or limits chosen per
+    // tile by budget, stopping between tiles once deadline passes; false if
+    // it did
+    bool renderTiles(unsigned char (*pixels)[3], int stride,
+                     int x0, int y0, int x1, int y1,
+                     int maxdepth, Real cutoff, Clock::time_point deadline,
+                     Budget *budget = nullptr) const;
+
+    // add samples [first, first+count) of every pixel in the region to
+    // sum, five floats per pixel; false if deadline cut it short
+    bool addPaths(std::vector<float> &sum, int x0, int y0, int x1, int y1,
+                  int first, int count, Clock::time_point deadline) const;
+
+    // write averaged path samples to pixels and add to the noise estimate
+    void resolvePaths(const std::vector<float> &sum, unsigned char (*pixels)[3],
+                      int stride, int width, int height) const;
+};
+
+#endif
@@ -0,0 +1,181 @@
+// implementation code for Reprojection class
+// warps last frame's primary hits into the new view and re-checks them
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Reprojection.hpp"
+
+// other classes used directly in the implementation
+#include "Instance.hpp"
+#include "Object.hpp"
+#include "Ray.hpp"
+#include "World.hpp"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+
+Reprojection::Reprojection()
+    : width(0), height(0), reused(0), traced(0)
+{}
+
+// where world point X lands in the view: pixel coordinates and distance
+// along the view direction, false if behind the eye
+static bool toPixel(const World &world, const Vec3 &X, Real &x, Real &y, Real &z)
+{
+    Vec3 d = X - world.eye;
+    z = -dot(d, world.w);
+    if (z <= 0) return false;
+    Real us = dot(d, world.u) * world.dist / z;
+    Real vs = dot(d, world.v) * world.dist / z;
+    x = (us - world.left) / (world.right - world.left) * world.width;
+    y = (vs - world.top) / (world.bottom - world.top) * world.height;
+    return true;
+}
+
+bool Reprojection::project(const World &world, const Vec3 &lo, const Vec3 &hi,
+                           int &x0, int &y0, int &x1, int &y1)
+{
+    Real xlo = INFINITY, ylo = INFINITY, xhi = -INFINITY, yhi = -INFINITY;
+    for (int c = 0; c < 8; ++c) {
+        Vec3 corner((c & 1) ? hi[0] : lo[0], (c & 2) ? hi[1] : lo[1], (c & 4) ? hi[2] : lo[2]);
+        Real x, y, z;
+        if (!toPixel(world, corner, x, y, z))
+            return false;
+        xlo = std::min(xlo, x);  xhi = std::max(xhi, x);
+        ylo = std::min(ylo, y);  yhi = std::max(yhi, y);
+    }
+
+    // a pixel of margin for rays through pixel centers near the edge,
+    // clamped on both sides before converting, as a box off to one side
+    // lands far outside the image
+    Real w = Real(world.width), h = Real(world.height);
+    x0 = int(std::min(w, std::max(Real(0), std::floor(xlo) - 1)));
+    y0 = int(std::min(h, std::max(Real(0), std::floor(ylo) - 1)));
+    x1 = int(std::min(w, std::max(Real(0), std::ceil(xhi) + 1)));
+    y1 = int(std::min(h, std::max(Real(0), std::ceil(yhi) + 1)));
+    return true;
+}
+
+void Reprojection::moved(const Vec3 &lo, const Vec3 &hi)
+{
+    movedLo.push_back(lo);
+    movedHi.push_back(hi);
+}
+
+void Reprojection::newFrame(const World &world)
+{
+    Entry none = { nullptr, nullptr, 0, { 0, 0, 0 } };
+    size_t pixels = size_t(world.width) * world.height;
+    if (world.width != width || world.height != height) {
+        // nothing carries over to a new image size
+        width = world.width;
+        height = world.height;
+        previous.assign(pixels, none);
+        current.assign(pixels, none);
+    }
+    else {
+        previous.swap(current);
+        std::fill(current.begin(), current.end(), none);
+    }
+    reused = traced = 0;
+
+    // each new pixel takes the nearest old hit that lands in it
+    source.assign(pixels, -1);
+    std::vector<float> depth(pixels, INFINITY);
+    for (size_t k = 0; k < previous.size(); ++k) {
+        const Entry &e = previous[k];
+        if (!e.obj) continue;
+        Real x, y, z;
+        if (!toPixel(world, Vec3(e.P[0], e.P[1], e.P[2]), x, y, z))
+            continue;
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            continue;
+        size_t p = size_t(y) * width + size_t(x);
+        if (z < depth[p]) {
+            depth[p] = float(z);
+            source[p] = int(k);
+        }
+    }
+
+    // a point next to a hole, a nearer point of another object or a
+    // clearly nearer point of its own may have come through a gap between
+    // the points of a nearer surface, or lie where two surfaces cross, so
+    // those pixels are traced
+    std::vector<int> landed(source);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            size_t p = size_t(y) * width + x;
+            if (landed[p] < 0) continue;
+            const Entry &e = previous[landed[p]];
+            bool edge = x == 0 || y == 0 || x == width - 1 || y == height - 1;
+            for (int dy = -1; dy <= 1 && !edge; ++dy)
+                for (int dx = -1; dx <= 1 && !edge; ++dx) {
+                    size_t n = p + dy * width + dx;
+                    edge = landed[n] < 0 || depth[n] < depth[p] * 0.98f ||
+                           (depth[n] < depth[p] && (previous[landed[n]].obj != e.obj ||
+                                                    previous[landed[n]].inst != e.inst));
+                }
+            if (edge)
+                source[p] = -1;
+        }
+
+    // whatever a moved object now covers is traced
+    for (size_t b = 0; b < movedLo.size(); ++b) {
+        int x0, y0, x1, y1;
+        if (!project(world, movedLo[b], movedHi[b], x0, y0, x1, y1)) {
+            std::fill(source.begin(), source.end(), -1);
+            break;
+        }
+        if (x1 <= x0 || y1 <= y0)
+            continue;       // off screen
+        for (int y = y0; y < y1; ++y)
+            std::fill(source.begin() + size_t(y) * width + x0,
+                      source.begin() + size_t(y) * width + x1, -1);
+    }
+    movedLo.clear();
+    movedHi.clear();
+}
+
+bool Reprojection::reuse(int i, int j, const Ray &ray, Intersection &hit) const
+{
+    if (source.empty()) return false;
+    int k = source[size_t(j) * width + i];
+    if (k < 0) return false;
+
+    const Entry &e = previous[k];
+    Intersection h = e.inst ? e.inst->intersectPrim(ray, e.obj, e.prim)
+                            : e.obj->intersectPrim(ray, e.prim);
+    if (h.obj != e.obj || h.prim != e.prim)
+        return false;
+
+    // within two pixel widths of where it was
+    Vec3 P = ray.E + h.t * ray.D;
+    Vec3 d = P - Vec3(e.P[0], e.P[1], e.P[2]);
+    Real tolerance = 2 * ray.spread * h.t * std::sqrt(ray.D_dot_D);
+    if (dot(d, d) > tolerance * tolerance)
+        return false;
+
+    hit = h;
+    return true;
+}
+
+void Reprojection::record(int i, int j, const Ray &ray, const Intersection &hit)
+{
+    if (current.empty()) return;
+    Entry &e = current[size_t(j) * width + i];
+    e.obj = hit.obj;
+    e.inst = hit.inst;
+    e.prim = hit.prim;
+    if (hit.obj) {
+        Vec3 P = ray.E + hit.t * ray.D;
+        for (int a = 0; a < 3; ++a)
+            e.P[a] = float(P[a]);
+    }
+}
+
+double Reprojection::reusedFraction() const
+{
+    long long r = reused, t = traced;
+    return r + t ? double(r) / (r + t) : 0;
+}
@@ -0,0 +1,80 @@
+// reuse of last frame's primary hits after small camera moves
+#ifndef REPROJECTION_HPP
+#define REPROJECTION_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Intersection.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <atomic>
+#include <vector>
+
+// classes we only use by pointer or reference
+class World;
+class Ray;
+
+// Keeps the object, part and world position each pixel's primary ray hit.
+// At the start of a frame those points are projected into the new view,
+// nearest first, so each new pixel gets the point that lands on it. The
+// pixel reuses that hit if its new ray still meets the same part of the
+// same object within a couple of pixel widths of the point, a single
+// primitive test; pixels with no point (disoccluded, or misses last
+// frame), whose test fails, or that a moved object may now cover are
+// traced in full. Shading is always recomputed.
+//
+// A surface that was hidden or off screen last frame and now lies in
+// front of a reused point is not seen; moves are assumed small.
+class Reprojection {
+public: // constructors
+    Reprojection();
+
+public: // frames
+    // finish the frame recorded so far and project its hits into world's
+    // current view; call before rendering each frame
+    void newFrame(const World &world);
+
+    // box lo-hi holds an object that moved since the last frame, so new
+    // pixels it covers must be traced; call before newFrame
+    void moved(const Vec3 &lo, const Vec3 &hi);
+
+    // hit along ray for pixel (i,j) if last frame's still holds
+    bool reuse(int i, int j, const Ray &ray, Intersection &hit) const;
+
+    // keep pixel (i,j)'s hit along ray for the next frame
+    void record(int i, int j, const Ray &ray, const Intersection &hit);
+
+    // count pixels reused and traced this frame
+    void count(int reusedPixels, int tracedPixels) {
+        reused += reusedPixels;
+        traced += tracedPixels;
+    }
+
+public: // statistics
+    // fraction of primary rays reused since newFrame
+    double reusedFraction() const;
+
+private:
+    // one pixel's primary hit
+    struct Entry {
+        const Object *obj;          // null for a miss or no hit kept
+        const Instance *inst;
+        int prim;
+        float P[3];                 // world position
+    };
+
+    // window of pixels box lo-hi covers in world's view, clamped to the
+    // image and empty if the box is outside it; false if it reaches
+    // behind the eye
+    static bool project(const World &world, const Vec3 &lo, const Vec3 &hi,
+                        int &x0, int &y0, int &x1, int &y1);
+
+private: // private data
+    int width, height;
+    std::vector<Entry> previous, current;   // last frame's hits, this one's
+    std::vector<int> source;                // previous entry per pixel, or -1
+    std::vector<Vec3> movedLo, movedHi;     // boxes since the last frame
+    std::atomic<long long> reused, traced;
+};
+
+#endif
@@ -0,0 +1,86 @@
+// implementation code for SceneArena class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "SceneArena.hpp"
+
+// other classes used directly in the implementation
+#include "Object.hpp"
+
+// system includes
+#include <stdint.h>
+
+SceneArena::SceneArena(size_t _blockSize)
+    : blockSize(_blockSize), next(nullptr), remaining(0), used(0), reserved(0)
+{}
+
+SceneArena::~SceneArena()
+{
+    release();
+}
+
+// carve aligned storage out of the current block, starting a new one if full
+void *SceneArena::allocate(size_t bytes, size_t align)
+{
+    size_t pad = (align - uintptr_t(next) % align) % align;
+    if (!next || pad + bytes > remaining) {
+        // over-allocate by align so the first object can always be aligned
+        size_t size = bytes + align > blockSize ? bytes + align : blockSize;
+        next = new char[size];
+        remaining = size;
+        reserved += size;
+        blocks.push_back(next);
+        pad = (align - uintptr_t(next) % align) % align;
+    }
+
+    void *mem = next + pad;
+    next += pad + bytes;
+    remaining -= pad + bytes;
+    used += pad + bytes;
+    return mem;
+}
+
+void SceneArena::swap(SceneArena &other)
+{
+    std::swap(blocks, other.blocks);
+    std::swap(blockSize, other.blockSize);
+    std::swap(next, other.next);
+    std::swap(remaining, other.remaining);
+    std::swap(used, other.used);
+    std::swap(reserved, other.reserved);
+    std::swap(objects, other.objects);
+}
+
+// this arena keeps allocating from its own last block
+void SceneArena::append(SceneArena &other)
+{
+    blocks.insert(blocks.end(), other.blocks.begin(), other.blocks.end());
+    objects.insert(objects.end(), other.objects.begin(), other.objects.end());
+    used += other.used;
+    reserved += other.reserved;
+
+    other.blocks.clear();
+    other.objects.clear();
+    other.next = nullptr;
+    other.remaining = 0;
+    other.used = 0;
+    other.reserved = 0;
+}
+
+// objects may own memory of their own (e.g. polygon vertex lists), so run
+// their destructors before dropping the blocks
+void SceneArena::release()
+{
+    for (auto obj : objects)
+        obj->~Object();
+    objects.clear();
+
+    for (auto block : blocks)
+        delete[] block;
+    blocks.clear();
+
+    next = nullptr;
+    remaining = 0;
+    used = 0;
+    reserved = 0;
+}
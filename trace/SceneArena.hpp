@@ -0,0 +1,64 @@
+// contiguous storage for scene primitives
+#ifndef SCENEARENA_HPP
+#define SCENEARENA_HPP
+
+// system includes necessary for the interface
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+// classes we only use by pointer or reference
+class Object;
+
+// bump allocator that places every primitive of a scene back to back in a
+// few large blocks. Objects made here are shared by every list and
+// acceleration structure, and all of them are destroyed together by
+// release() or the arena destructor.
+class SceneArena {
+private: // private data
+    std::vector<char*> blocks;      // allocated blocks, in order
+    size_t blockSize;               // size for new blocks
+    char *next;                     // next free byte in the last block
+    size_t remaining;               // free bytes left in the last block
+    size_t used;                    // bytes handed out, including padding
+    size_t reserved;                // bytes in all blocks
+    std::vector<Object*> objects;   // everything made here, for destruction
+
+public: // constructor & destructor
+    SceneArena(size_t _blockSize = 1 << 20);
+    ~SceneArena();
+
+    // arena owns its memory, so no copies
+    SceneArena(const SceneArena&) = delete;
+    SceneArena &operator=(const SceneArena&) = delete;
+
+public: // allocation
+    // raw aligned storage that lives until release()
+    void *allocate(size_t bytes, size_t align);
+
+    // construct an object in the arena
+    template <typename T, typename... Args>
+    T *make(Args&&... args) {
+        T *obj = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        objects.push_back(obj);
+        return obj;
+    }
+
+    // destroy all objects and free all blocks
+    void release();
+
+    // exchange contents, to replace an arena with one built alongside it
+    void swap(SceneArena &other);
+
+    // take over other's blocks and objects after this arena's own, such as
+    // one filled on another thread, leaving other empty
+    void append(SceneArena &other);
+
+public: // statistics
+    size_t count() const { return objects.size(); }    // objects made
+    size_t bytesUsed() const { return used; }           // bytes handed out
+    size_t bytesReserved() const { return reserved; }   // bytes in blocks
+};
+
+#endif
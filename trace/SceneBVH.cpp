@@ -0,0 +1,160 @@
+// implementation code for SceneBVH class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "SceneBVH.hpp"
+
+// other classes used directly in the implementation
+#include "Object.hpp"
+#include "ObjectList.hpp"
+
+// system includes
+#include <cmath>
+#include <iostream>
+
+// append v as base-128 digits, low first, high bit set on all but the last
+static void putVarint(std::vector<uint8_t> &out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(uint8_t(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(uint8_t(v));
+}
+
+static uint32_t getVarint(const uint8_t *&in)
+{
+    uint32_t v = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *in++;
+        v |= uint32_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+}
+
+SceneBVH::SceneBVH(const ObjectList *list, BuildMode mode)
+    : objects(&list->objects)
+{
+    const std::vector<Object*> &objs = list->objects;
+    std::vector<BVHBox> boxes(objs.size());
+    for (size_t i = 0; i < objs.size(); ++i) {
+        Vec3 lo, hi;
+        objs[i]->bounds(lo, hi);
+        // round outward so double precision bounds stay inside
+        for (int a = 0; a < 3; ++a) {
+            boxes[i].lo[a] = float(lo[a]);
+            if (boxes[i].lo[a] > lo[a])
+                boxes[i].lo[a] = std::nextafter(boxes[i].lo[a], -INFINITY);
+            boxes[i].hi[a] = float(hi[a]);
+            if (boxes[i].hi[a] < hi[a])
+                boxes[i].hi[a] = std::nextafter(boxes[i].hi[a], INFINITY);
+        }
+    }
+
+    if (mode == LINEAR)
+        bvh.buildLinear(boxes);
+    else
+        bvh.build(boxes);
+
+    // leaves become short runs of small index deltas, since sorted objects
+    // that share a leaf are mostly close together in the list
+    if (mode == COMPRESSED) {
+        bool built = qbvh.build(bvh, [&](int first, int count) {
+            uint32_t offset = uint32_t(indices.size());
+            int previous = 0;
+            for (int s = first; s < first + count; ++s) {
+                int index = bvh.order[s];
+                if (s == first)
+                    putVarint(indices, uint32_t(index));
+                else {
+                    int delta = index - previous;
+                    putVarint(indices, uint32_t(delta << 1) ^ uint32_t(delta >> 31));
+                }
+                previous = index;
+            }
+            return offset;
+        });
+        if (built) {
+            indices.shrink_to_fit();
+            std::vector<BVHNode>().swap(bvh.nodes);
+            std::vector<int>().swap(bvh.order);
+            return;
+        }
+        std::vector<uint8_t>().swap(indices);
+        std::cerr << "Compressed BVH: index list past " << (QBVH::PayloadMask + 1)
+                  << " bytes, using the uncompressed BVH\n";
+    }
+
+    // objects in slot order so each leaf's pointers are contiguous
+    items.resize(objs.size());
+    for (size_t s = 0; s < objs.size(); ++s)
+        items[s] = objs[bvh.order[s]];
+    std::vector<int>().swap(bvh.order);
+}
+
+Intersection SceneBVH::trace(const Ray &r) const
+{
+    ++RayCounts::current->rays;
+    Intersection closest;
+    Real far = r.far;
+    if (!qbvh.nodes.empty()) {
+        const std::vector<Object*> &objs = *objects;
+        qbvh.closest(r, far, [&](uint32_t offset, int count, Real &far) {
+            const uint8_t *in = &indices[offset];
+            int index = 0;
+            for (int k = 0; k < count; ++k) {
+                uint32_t v = getVarint(in);
+                index = k == 0 ? int(v) : index + (int(v >> 1) ^ -int(v & 1));
+                Intersection current = objs[index]->intersect(r);
+                if (current < closest && current.t < far) {
+                    closest = current;
+                    far = current.t;
+                }
+            }
+        });
+        return closest;
+    }
+
+    bvh.closest(r, far, [&](int first, int count, Real &far) {
+        for (int s = first; s < first + count; ++s) {
+            Intersection current = items[s]->intersect(r);
+            if (current < closest && current.t < far) {
+                closest = current;
+                far = current.t;
+            }
+        }
+    });
+    return closest;
+}
+
+bool SceneBVH::probe(const Ray &r) const
+{
+    ++RayCounts::current->shadows;
+    if (!qbvh.nodes.empty()) {
+        const std::vector<Object*> &objs = *objects;
+        return qbvh.any(r, [&](uint32_t offset, int count) {
+            const uint8_t *in = &indices[offset];
+            int index = 0;
+            for (int k = 0; k < count; ++k) {
+                uint32_t v = getVarint(in);
+                index = k == 0 ? int(v) : index + (int(v >> 1) ^ -int(v & 1));
+                if (objs[index]->intersect(r).t < r.far)
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    return bvh.any(r, [&](int first, int count) {
+        for (int s = first; s < first + count; ++s)
+            if (items[s]->intersect(r).t < r.far)
+                return true;
+        return false;
+    });
+}
+
+size_t SceneBVH::bytes() const
+{
+    return bvh.nodes.capacity() * sizeof(BVHNode) + items.capacity() * sizeof(Object*)
+        + qbvh.bytes() + indices.capacity();
+}
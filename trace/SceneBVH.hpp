@@ -0,0 +1,47 @@
+// bounding volume hierarchy over scene objects
+#ifndef SCENEBVH_HPP
+#define SCENEBVH_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Accel.hpp"
+#include "BVH.hpp"
+#include "QBVH.hpp"
+
+// system includes necessary for the interface
+#include <cstdint>
+#include <vector>
+
+// classes we only use by pointer or reference
+class Object;
+class ObjectList;
+
+// BVH alternative to the KD-tree for the top level of the scene. Objects are
+// not owned and must not move; unlike KDTree there are no dynamic updates.
+class SceneBVH : public Accel {
+public:
+    enum BuildMode {
+        SAH,        // binned surface area heuristic
+        LINEAR,     // Morton-code radix splits, fastest to build
+        COMPRESSED  // SAH collapsed to quantized 4-wide nodes, with leaves
+                    // as delta-coded indices into the object list
+    };
+
+    SceneBVH(const ObjectList *list, BuildMode mode = SAH);
+
+    Intersection trace(const Ray &r) const override;
+    bool probe(const Ray &r) const override;
+    size_t bytes() const override;
+    Accel *clone() const override { return new SceneBVH(*this); }
+
+public:
+    BVH bvh;                        // hierarchy over the object boxes
+    std::vector<Object*> items;     // objects in BVH slot order
+
+    // compressed form, used instead of bvh and items when built
+    QBVH qbvh;
+    const std::vector<Object*> *objects;    // list the indices refer to
+    std::vector<uint8_t> indices;   // per leaf: first index, then zigzag
+                                    // deltas, all as base-128 varints
+};
+
+#endif
@@ -5,10 +5,14 @@
 #include "Sphere.hpp"
 
 // other classes used directly in the implementation
+#include "SceneArena.hpp"
 #include "World.hpp"
 #include "Ray.hpp"
 
-Sphere::Sphere(const Surface &_surface, const Vec3 _center, float _radius)
+// system includes
+#include <algorithm>
+
+Sphere::Sphere(const Surface &_surface, const Vec3 _center, Real _radius)
     : Object(_surface) 
 {
     C = _center;
@@ -21,18 +25,18 @@ const Intersection
 Sphere::intersect(const Ray &r) const
 {
     // solve p=r.start-center + t*r.direction; p*p -radius^2=0
-    float a = r.D_dot_D;
+    Real a = r.D_dot_D;
     Vec3 g = r.E - C;
-    float b = dot(r.D, g);
-    float c = dot(g,g) - Rsquared;
+    Real b = dot(r.D, g);
+    Real c = dot(g,g) - Rsquared;
 
-    float discriminant = b*b - a*c;
+    Real discriminant = b*b - a*c;
     if (discriminant < 0)       // no intersection
         return Intersection();
 
     // solve quadratic equation for desired surface
-    float dsq = sqrtf(discriminant);
-    float t = (-b - dsq) / a;       // first intersection within ray extent?
+    Real dsq = std::sqrt(discriminant);
+    Real t = (-b - dsq) / a;       // first intersection within ray extent?
     if (t > r.near && t < r.far) 
         return Intersection(this,t);
 
@@ -49,12 +53,33 @@ const Vec3 Sphere::normal(const Vec3 P) const
     return normalize(P - C);
 }
 
-Vec3 Sphere::getCenter()
+Vec3 Sphere::getCenter() const
 {
     return C;
 }
 
-float Sphere::getRadius()
+Real Sphere::getRadius() const
 {
     return R;
-}
\ No newline at end of file
+}
+// longitude and latitude around the z axis, the scenes' up direction
+bool Sphere::uv(const Vec3 P, int /*prim*/, Real &u, Real &v, Real &scale) const
+{
+    Vec3 n = (P - C) / R;
+    u = Real(0.5) + std::atan2(n[1], n[0]) * Real(0.5 / M_PI);
+    v = std::acos(std::max(Real(-1), std::min(Real(1), n[2]))) * Real(1 / M_PI);
+    scale = Real(2 * M_PI) * R;
+    return true;
+}
+
+void Sphere::bounds(Vec3 &lo, Vec3 &hi) const
+{
+    Vec3 r(R, R, R);
+    lo = C - r;
+    hi = C + r;
+}
+
+Object *Sphere::relocate(SceneArena &arena)
+{
+    return arena.make<Sphere>(std::move(*this));
+}
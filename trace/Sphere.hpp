@@ -14,19 +14,28 @@ class Ray;
 // sphere objects
 class Sphere : public Object {
     Vec3 C;
-    float R;
+    Real R;
 
     // derived, for intersection testing
-    float Rsquared;
+    Real Rsquared;
 
 public: // constructors
-    Sphere(const Surface &_surface, const Vec3 _center, float _radius);
+    Sphere(const Surface &_surface, const Vec3 _center, Real _radius);
+
+public: // manipulators
+    // move the sphere; update acceleration structures afterwards
+    void setCenter(const Vec3 _center) { C = _center; }
+
+public: // accessors
+    Vec3 getCenter() const;
+    Real getRadius() const;
 
 public: // object functions
     const Intersection intersect(const Ray &ray) const override;
     const Vec3 normal(const Vec3 P) const override;
-    Vec3 getCenter() override;
-    float getRadius() override;
+    bool uv(const Vec3 P, int prim, Real &u, Real &v, Real &scale) const override;
+    Object *relocate(SceneArena &arena) override;
+    void bounds(Vec3 &lo, Vec3 &hi) const override;
 };
 
 #endif
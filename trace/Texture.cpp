@@ -0,0 +1,208 @@
+// implementation code for Texture class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "Texture.hpp"
+
+// other classes used directly in the implementation
+#include "ObjectList.hpp"
+
+// system includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+// ids start at 1 so empty cache entries (id 0) never match
+static std::atomic<unsigned int> NextId(1);
+
+// position of texel (x,y) within its 8x8 tile, bits interleaved y x y x y x
+static inline int morton(int x, int y)
+{
+    return (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) |
+           ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+}
+
+// Small direct-mapped cache of tiles decoded to float, one per thread.
+// 32 entries of 64 texels is 24 KB, small enough to stay in L1/L2 while a
+// thread works through one image tile.
+namespace {
+struct TileCache {
+    static const int Entries = 32;
+    static const int Texels = Texture::TileSize * Texture::TileSize;
+    struct Entry {
+        unsigned int id;        // texture, 0 if empty
+        int level, tile;
+        float rgb[Texels][3];
+    } entry[Entries];
+
+    TileCache() {
+        for (auto &e : entry) e.id = 0;
+    }
+};
+}
+static thread_local TileCache cache;
+
+Texture::Texture()
+    : id(NextId++)
+{}
+
+bool
+Texture::load(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return false;
+
+    // header, as in the GLapp loader
+    char magic[3] = "";
+    int width = 0, height = 0, maxval = 0;
+    bool ok = fscanf(fp, "%2s", magic) == 1 && strcmp(magic, "P6") == 0;
+    fscanf(fp, " #%*[^\n]");                // skip comment (if there)
+    ok = ok && fscanf(fp, "%d %d", &width, &height) == 2;
+    fscanf(fp, " #%*[^\n]");                // skip comment (if there)
+    ok = ok && fscanf(fp, "%d", &maxval) == 1 && maxval == 255;
+    fgetc(fp);                              // single whitespace before data
+    ok = ok && width > 0 && height > 0;
+
+    std::vector<unsigned char> rgb;
+    if (ok) {
+        rgb.resize(size_t(width) * height * 3);
+        ok = fread(rgb.data(), 3, size_t(width) * height, fp) == size_t(width) * height;
+    }
+    fclose(fp);
+    if (!ok) return false;
+
+    // each level a 2x2 box filter of the one above, down to 1x1
+    levels.clear();
+    for (;;) {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.tilesX = (width + TileSize - 1) >> TileBits;
+        int tilesY = (height + TileSize - 1) >> TileBits;
+        level.texels.assign(size_t(level.tilesX) * tilesY * TileSize * TileSize, 0);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const unsigned char *c = &rgb[3 * (size_t(y) * width + x)];
+                size_t tile = size_t(y >> TileBits) * level.tilesX + (x >> TileBits);
+                level.texels[(tile << (2 * TileBits)) + morton(x & (TileSize-1), y & (TileSize-1))] =
+                    uint32_t(c[0]) | uint32_t(c[1]) << 8 | uint32_t(c[2]) << 16;
+            }
+        }
+        levels.push_back(std::move(level));
+        if (width == 1 && height == 1) break;
+
+        int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+        std::vector<unsigned char> next(size_t(w) * h * 3);
+        for (int y = 0; y < h; ++y) {
+            int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < w; ++x) {
+                int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                for (int c = 0; c < 3; ++c)
+                    next[3 * (size_t(y) * w + x) + c] = (unsigned char)(
+                        (rgb[3 * (size_t(y0) * width + x0) + c] + rgb[3 * (size_t(y0) * width + x1) + c] +
+                         rgb[3 * (size_t(y1) * width + x0) + c] + rgb[3 * (size_t(y1) * width + x1) + c] + 2) / 4);
+            }
+        }
+        rgb.swap(next);
+        width = w;
+        height = h;
+    }
+    return true;
+}
+
+bool
+Texture::dropFinest()
+{
+    if (levels.size() <= 1) return false;
+    levels.erase(levels.begin());
+    return true;
+}
+
+size_t
+Texture::bytes() const
+{
+    size_t total = 0;
+    for (const auto &level : levels)
+        total += level.texels.size() * sizeof(uint32_t);
+    return total;
+}
+
+// look up the tile holding (x,y), decoding it into the cache on a miss
+Vec3
+Texture::texel(int level, int x, int y) const
+{
+    const Level &l = levels[level];
+    int tile = (y >> TileBits) * l.tilesX + (x >> TileBits);
+    unsigned int slot = (unsigned(tile) * 2654435761u ^ unsigned(level) * 40503u ^ id * 9973u)
+        % TileCache::Entries;
+
+    TileCache::Entry &e = cache.entry[slot];
+    if (e.id != id || e.level != level || e.tile != tile) {
+        ++RayCounts::pending.textureMisses;
+        e.id = id;
+        e.level = level;
+        e.tile = tile;
+        const uint32_t *src = &l.texels[size_t(tile) << (2 * TileBits)];
+        for (int i = 0; i < TileCache::Texels; ++i) {
+            e.rgb[i][0] = (src[i] & 0xff) * (1.f / 255);
+            e.rgb[i][1] = (src[i] >> 8 & 0xff) * (1.f / 255);
+            e.rgb[i][2] = (src[i] >> 16 & 0xff) * (1.f / 255);
+        }
+    }
+    else
+        ++RayCounts::pending.textureHits;
+
+    const float *rgb = e.rgb[morton(x & (TileSize-1), y & (TileSize-1))];
+    return Vec3(rgb[0], rgb[1], rgb[2]);
+}
+
+Vec3
+Texture::bilinear(int level, Real u, Real v) const
+{
+    const Level &l = levels[level];
+    Real x = u * l.width - Real(0.5), y = v * l.height - Real(0.5);
+    Real fx = std::floor(x), fy = std::floor(y);
+    int x0 = int(fx), y0 = int(fy);
+    fx = x - fx;
+    fy = y - fy;
+
+    // repeat at the edges
+    x0 = (x0 % l.width + l.width) % l.width;
+    y0 = (y0 % l.height + l.height) % l.height;
+    int x1 = x0 + 1 == l.width ? 0 : x0 + 1;
+    int y1 = y0 + 1 == l.height ? 0 : y0 + 1;
+
+    Vec3 c00 = texel(level, x0, y0), c10 = texel(level, x1, y0);
+    Vec3 c01 = texel(level, x0, y1), c11 = texel(level, x1, y1);
+    return (1 - fy) * ((1 - fx) * c00 + fx * c10) +
+                fy  * ((1 - fx) * c01 + fx * c11);
+}
+
+// level where the footprint covers about one texel, blended with the next
+Vec3
+Texture::sample(Real u, Real v, Real width) const
+{
+    int last = int(levels.size()) - 1;
+    Real texels = width * std::max(levels[0].width, levels[0].height);
+    Real lod = texels > 1 ? std::log2(texels) : 0;
+    if (lod <= 0) return bilinear(0, u, v);
+    if (lod >= last) return bilinear(last, u, v);
+
+    int level = int(lod);
+    Real f = lod - level;
+    return (1 - f) * bilinear(level, u, v) + f * bilinear(level + 1, u, v);
+}
+
+void
+Texture::printStats(const RayCounts &counts)
+{
+    // include the calling thread's own lookups
+    RayCounts::flush();
+    unsigned long long hits = counts.textureHits, misses = counts.textureMisses;
+    if (hits + misses == 0) return;
+    std::cout << "texture cache: " << hits << " hits, " << misses << " misses ("
+        << 100.0 * hits / (hits + misses) << "% hits)\n";
+}
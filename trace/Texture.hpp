@@ -0,0 +1,65 @@
+// mipmapped image textures
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <cstdint>
+#include <vector>
+
+// classes we only use by pointer or reference
+struct RayCounts;
+
+// PPM texture stored as a mip pyramid. Every level is cut into 8x8 tiles,
+// row by row, with the texels of a tile in Morton order, so a filtered
+// lookup touches one or two tiles of 256 bytes instead of scattered rows.
+// Lookups go through a small per-thread cache of decoded tiles.
+class Texture {
+public: // public types
+    static const int TileBits = 3;              // tiles are 8x8 texels
+    static const int TileSize = 1 << TileBits;
+
+    struct Level {
+        int width, height;                      // size in texels
+        int tilesX;                             // tiles per row
+        std::vector<uint32_t> texels;           // 0xBBGGRR, tile after tile
+    };
+
+public: // public data
+    std::vector<Level> levels;                  // finest first, down to 1x1
+    unsigned int id;                            // unique, for cache tags
+
+public: // constructor
+    Texture();
+
+    // read a binary (P6) PPM and build the pyramid; false on failure
+    bool load(const char *filename);
+
+public: // manipulators
+    // give up the finest level to save memory; false if only 1x1 is left
+    bool dropFinest();
+
+public: // computational members
+    // trilinear color at (u,v), repeating outside [0,1], for a footprint
+    // width in texture coordinates (1 = whole texture)
+    Vec3 sample(Real u, Real v, Real width) const;
+
+    // bytes of texel storage in all levels
+    size_t bytes() const;
+
+public: // statistics
+    // print the tile cache hits and misses counted in counts
+    static void printStats(const RayCounts &counts);
+
+private:
+    // bilinear color at (u,v) in one level
+    Vec3 bilinear(int level, Real u, Real v) const;
+
+    // one texel, through the calling thread's tile cache; a copy, as the
+    // next lookup may reuse the cache slot it came from
+    Vec3 texel(int level, int x, int y) const;
+};
+
+#endif
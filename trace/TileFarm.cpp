@@ -0,0 +1,99 @@
+// implementation code for TileFarm class
+// forks worker processes that share one framebuffer with the parent
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "TileFarm.hpp"
+
+// other classes used directly in the implementation
+#include "Renderer.hpp"
+
+// system includes
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+TileFarm::TileFarm(const Renderer &_renderer, int _workers)
+    : renderer(_renderer), workers(std::max(1, _workers))
+{}
+
+// anonymous shared mapping survives fork with both sides seeing writes
+unsigned char (*TileFarm::allocShared(size_t count))[3]
+{
+#ifndef _WIN32
+    void *mem = mmap(nullptr, count*3, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+        return (unsigned char (*)[3])mem;
+    std::cerr << "shared framebuffer allocation failed, rendering in-process\n";
+#endif
+    return nullptr;
+}
+
+void TileFarm::freeShared(unsigned char (*pixels)[3], size_t count)
+{
+#ifndef _WIN32
+    if (pixels) munmap(pixels, count*3);
+#endif
+}
+
+// fork one worker per strip, then wait for all of them
+int TileFarm::render(unsigned char (*pixels)[3], int stride,
+                     int x0, int y0, int x1, int y1) const
+{
+#ifdef _WIN32
+    renderer.render(pixels, stride, x0, y0, x1, y1);
+    return 0;
+#else
+    // strips are whole tile rows so workers never share a tile
+    int tileRows = (y1 - y0 + renderer.tileSize - 1) / renderer.tileSize;
+    int strips = std::min(workers, tileRows);
+    if (strips <= 1) {
+        renderer.render(pixels, stride, x0, y0, x1, y1);
+        return 0;
+    }
+
+    // split the parent's threads among the workers
+    Renderer child(renderer);
+    child.threads = std::max(1, renderer.threads / strips);
+
+    struct Strip { int y0, y1; pid_t pid; };
+    std::vector<Strip> list;
+    for (int s = 0; s < strips; ++s) {
+        Strip strip;
+        strip.y0 = y0 + tileRows * s / strips * renderer.tileSize;
+        strip.y1 = std::min(y1, y0 + tileRows * (s+1) / strips * renderer.tileSize);
+
+        std::cout.flush();
+        strip.pid = fork();
+        if (strip.pid == 0) {
+            child.render(pixels + (strip.y0 - y0) * stride, stride,
+                         x0, strip.y0, x1, strip.y1);
+            _exit(0);
+        }
+        list.push_back(strip);
+    }
+
+    // collect workers, re-rendering any strip whose worker failed
+    int recovered = 0;
+    for (auto &strip : list) {
+        int status = 0;
+        bool ok = strip.pid > 0 && waitpid(strip.pid, &status, 0) == strip.pid
+            && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok) {
+            std::cerr << "worker for rows " << strip.y0 << '-' << strip.y1
+                << " failed, rendering in-process\n";
+            renderer.render(pixels + (strip.y0 - y0) * stride, stride,
+                            x0, strip.y0, x1, strip.y1);
+            ++recovered;
+        }
+    }
+    return recovered;
+#endif
+}
@@ -0,0 +1,35 @@
+// multi-process rendering on the local machine
+#ifndef TILEFARM_HPP
+#define TILEFARM_HPP
+
+// system includes necessary for the interface
+#include <stddef.h>
+
+// classes we only use by pointer or reference
+class Renderer;
+
+// splits a region into horizontal strips and renders each in a forked
+// worker process writing into a shared-memory framebuffer. A worker that
+// crashes or is killed only loses its own strip, which is re-rendered in
+// the parent. Without fork (Windows), everything renders in-process.
+class TileFarm {
+public: // public data
+    const Renderer &renderer;   // renderer each worker runs
+    int workers;                // number of worker processes
+
+public: // constructors
+    TileFarm(const Renderer &_renderer, int _workers);
+
+public: // shared framebuffer management
+    // allocate pixels visible to forked workers; free with freeShared
+    static unsigned char (*allocShared(size_t count))[3];
+    static void freeShared(unsigned char (*pixels)[3], size_t count);
+
+public: // computational members
+    // same contract as Renderer::render, but pixels must come from allocShared
+    // returns number of strips that had to be recovered in-process
+    int render(unsigned char (*pixels)[3], int stride,
+               int x0, int y0, int x1, int y1) const;
+};
+
+#endif
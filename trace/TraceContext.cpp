@@ -0,0 +1,141 @@
+// implementation code for TraceContext class
+// loads, builds and renders one scene for the trace library
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "TraceContext.hpp"
+
+// other classes used directly in the implementation
+#include "Profile.hpp"
+
+// system includes
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+TraceContext::TraceContext(const Options &_options)
+    : options(_options), sorted(false), loadSeconds(0), sortSeconds(0), buildSeconds(0)
+{
+    // meshes build their own hierarchies while the scene is read
+    options.world.compressedMeshes = options.accel == COMPRESSED_BVH;
+
+    // the treelet file has the spheres, so they needn't fit in memory twice
+    if (options.treelets)
+        options.world.effects &= ~World::SPHERES;
+}
+
+bool TraceContext::load(std::istream &input)
+{
+    if (!input)
+        return false;
+    Clock::time_point start = Clock::now();
+    world.reset(new World(input, options.world));
+    loadSeconds = seconds(start);
+    return true;
+}
+
+bool TraceContext::loadFile(const char *filename)
+{
+    std::ifstream input(filename);
+    if (!input) {
+        std::cerr << "Error opening " << filename << '\n';
+        return false;
+    }
+    return load(input);
+}
+
+bool TraceContext::load(const char *data, size_t size)
+{
+    std::istringstream input(std::string(data, size));
+    return load(input);
+}
+
+// primitives close in space go next to each other in memory, so the
+// structures built over them read contiguous objects
+void TraceContext::sort()
+{
+    if (!options.sort || sorted || !world)
+        return;
+    PROFILE_SCOPE("sort");
+    Clock::time_point start = Clock::now();
+    world->spatialSort();
+    sortSeconds = seconds(start);
+    sorted = true;
+}
+
+bool TraceContext::build()
+{
+    if (!world)
+        return false;
+    sort();
+    PROFILE_SCOPE("build");
+
+    // out of core, the treelet file is the whole scene
+    Clock::time_point start = Clock::now();
+    if (options.treelets) {
+        if (!world->objects->objects.empty()) {
+            std::cerr << "treelets render spheres only\n";
+            return false;
+        }
+        treeletScene.reset(new TreeletScene());
+        if (!treeletScene->open(options.treelets, options.treeletCache))
+            return false;
+    }
+    else if (options.accel == KD_TREE)
+        kdtree.reset(new KDTree(world->objects, options.kdBuild));
+    else
+        bvh.reset(new SceneBVH(world->objects,
+            options.accel == LINEAR_BVH ? SceneBVH::LINEAR :
+            options.accel == COMPRESSED_BVH ? SceneBVH::COMPRESSED : SceneBVH::SAH));
+    buildSeconds = seconds(start);
+
+    world->accel = &accel();
+    renderer.reset(new Renderer(*world, accel()));
+    renderer->counts = &counts;
+    if (options.reproject) {
+        reprojection.reset(new Reprojection());
+        renderer->reproject = reprojection.get();
+    }
+    return true;
+}
+
+const Accel &TraceContext::accel() const
+{
+    return kdtree ? static_cast<const Accel&>(*kdtree) :
+           bvh ? static_cast<const Accel&>(*bvh) : *treeletScene;
+}
+
+void TraceContext::render(unsigned char (*pixels)[3], int stride,
+                          int x0, int y0, int x1, int y1) const
+{
+    renderer->render(pixels, stride, x0, y0, x1, y1);
+}
+
+void TraceContext::render(unsigned char (*pixels)[3]) const
+{
+    if (reprojection)
+        reprojection->newFrame(*world);
+    renderer->render(pixels, world->width, 0, 0, world->width, world->height);
+}
+
+TraceContext::Stats TraceContext::stats() const
+{
+    Stats s;
+    s.loadSeconds = loadSeconds;
+    s.sortSeconds = sortSeconds;
+    s.buildSeconds = buildSeconds;
+    s.accelBytes = renderer ? accel().bytes() : 0;
+    s.rays = counts.rays;
+    s.shadowRays = counts.shadows;
+    s.textureHits = counts.textureHits;
+    s.textureMisses = counts.textureMisses;
+    return s;
+}
@@ -0,0 +1,101 @@
+// a scene loaded for rendering: the library's entry point
+#ifndef TRACECONTEXT_HPP
+#define TRACECONTEXT_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "KDTree.hpp"
+#include "ObjectList.hpp"
+#include "Renderer.hpp"
+#include "Reprojection.hpp"
+#include "SceneBVH.hpp"
+#include "TreeletScene.hpp"
+#include "World.hpp"
+
+// system includes necessary for the interface
+#include <istream>
+#include <memory>
+
+// Loads a scene, builds its acceleration structure and renders regions of
+// it into caller-owned buffers. Everything a render reads or counts is
+// held here, in the World and Renderer it owns, so separate contexts can
+// load and render at once in one process.
+//
+// Use: load(), then build(), then set renderer options and render().
+class TraceContext {
+public: // public types
+    enum AccelKind {            // top-level structure
+        KD_TREE,
+        SAH_BVH,
+        LINEAR_BVH,
+        COMPRESSED_BVH          // meshes build compressed hierarchies too
+    };
+
+    struct Options {
+        World::Options world;   // effects, texture budget
+        AccelKind accel;
+        KDTree::BuildMode kdBuild;
+        bool sort;              // Morton-order primitives before building
+        const char *treelets;   // render spheres from this treelet file instead
+        size_t treeletCache;    // resident treelet bytes, 0 for no limit
+        bool reproject;         // reuse primary hits from frame to frame
+        Options() : accel(KD_TREE), kdBuild(KDTree::IN_PLACE), sort(true),
+                    treelets(nullptr), treeletCache(0), reproject(false) {}
+    };
+
+    struct Stats {
+        double loadSeconds, sortSeconds, buildSeconds;
+        size_t accelBytes;      // top-level structure, 0 before build()
+        unsigned long long rays, shadowRays;    // traced by this context
+        unsigned long long textureHits, textureMisses;  // its texture lookups
+    };
+
+public: // public data
+    Options options;
+    std::unique_ptr<World> world;               // after load()
+
+    // the one structure build() made, the rest null
+    std::unique_ptr<KDTree> kdtree;
+    std::unique_ptr<SceneBVH> bvh;
+    std::unique_ptr<TreeletScene> treeletScene;
+
+    std::unique_ptr<Renderer> renderer;         // after build()
+    std::unique_ptr<Reprojection> reprojection; // if options.reproject
+    RayCounts counts;
+
+public: // constructors
+    TraceContext(const Options &_options = Options());
+
+public: // loading and building
+    // read a scene from a stream, a file or memory; false if there is
+    // nothing to read
+    bool load(std::istream &input);
+    bool loadFile(const char *filename);
+    bool load(const char *data, size_t size);
+
+    // Morton-order the scene's primitives if options.sort, once
+    void sort();
+
+    // sort, then build the top-level structure or open the treelet file,
+    // and make the renderer; false with a message if that fails
+    bool build();
+
+    // the structure build() made
+    const Accel &accel() const;
+
+public: // rendering
+    // render pixels [x0,x1) x [y0,y1) into pixels, where the pixel at
+    // (x0,y0) is pixels[0] and rows are stride pixels apart
+    void render(unsigned char (*pixels)[3], int stride,
+                int x0, int y0, int x1, int y1) const;
+
+    // render the whole width x height image as a new frame, rows packed
+    void render(unsigned char (*pixels)[3]) const;
+
+    Stats stats() const;
+
+private: // private data
+    bool sorted;
+    double loadSeconds, sortSeconds, buildSeconds;
+};
+
+#endif
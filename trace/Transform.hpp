@@ -0,0 +1,93 @@
+// affine transforms
+#ifndef TRANSFORM_HPP
+#define TRANSFORM_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Vec3.hpp"
+
+// affine transform p' = M p + offset, with M stored by rows
+class Transform {
+public: // public data
+    Vec3 row[3];        // rows of the linear part
+    Vec3 offset;        // translation
+
+public: // constructors
+    // identity
+    Transform() : offset(0,0,0) {
+        row[0] = Vec3(1,0,0);
+        row[1] = Vec3(0,1,0);
+        row[2] = Vec3(0,0,1);
+    }
+
+    static Transform translate(const Vec3 &t) {
+        Transform m;
+        m.offset = t;
+        return m;
+    }
+
+    static Transform scale(const Vec3 &s) {
+        Transform m;
+        m.row[0] = Vec3(s[0],0,0);
+        m.row[1] = Vec3(0,s[1],0);
+        m.row[2] = Vec3(0,0,s[2]);
+        return m;
+    }
+
+    // rotate by degrees counterclockwise about axis through the origin
+    static Transform rotate(const Vec3 &axis, Real degrees) {
+        Vec3 a = normalize(axis);
+        Real rad = degrees * Real(M_PI / 180);
+        Real c = std::cos(rad), s = std::sin(rad), t = 1 - c;
+        Transform m;
+        m.row[0] = Vec3(t*a[0]*a[0] + c,      t*a[0]*a[1] - s*a[2], t*a[0]*a[2] + s*a[1]);
+        m.row[1] = Vec3(t*a[0]*a[1] + s*a[2], t*a[1]*a[1] + c,      t*a[1]*a[2] - s*a[0]);
+        m.row[2] = Vec3(t*a[0]*a[2] - s*a[1], t*a[1]*a[2] + s*a[0], t*a[2]*a[2] + c);
+        return m;
+    }
+
+public: // computational members
+    // transform a direction (no translation)
+    Vec3 vector(const Vec3 &v) const {
+        return Vec3(dot(row[0], v), dot(row[1], v), dot(row[2], v));
+    }
+
+    // transform a point
+    Vec3 point(const Vec3 &p) const {
+        return vector(p) + offset;
+    }
+
+    // multiply a direction by the transpose of the linear part; applied with
+    // the inverse transform this takes normals to the transformed space
+    Vec3 transposeVector(const Vec3 &v) const {
+        return v[0]*row[0] + v[1]*row[1] + v[2]*row[2];
+    }
+
+    // composition: (a*b).point(p) == a.point(b.point(p))
+    Transform operator*(const Transform &b) const {
+        Transform m;
+        for (int i = 0; i < 3; ++i)
+            m.row[i] = Vec3(dot(row[i], Vec3(b.row[0][0], b.row[1][0], b.row[2][0])),
+                            dot(row[i], Vec3(b.row[0][1], b.row[1][1], b.row[2][1])),
+                            dot(row[i], Vec3(b.row[0][2], b.row[1][2], b.row[2][2])));
+        m.offset = point(b.offset);
+        return m;
+    }
+
+    // inverse, from the adjugate of the linear part
+    Transform inverse() const {
+        Vec3 c0 = cross(row[1], row[2]);
+        Vec3 c1 = cross(row[2], row[0]);
+        Vec3 c2 = cross(row[0], row[1]);
+        Real invDet = 1 / dot(row[0], c0);
+
+        // columns of the inverse are c0, c1, c2 scaled by 1/det
+        Transform m;
+        m.row[0] = invDet * Vec3(c0[0], c1[0], c2[0]);
+        m.row[1] = invDet * Vec3(c0[1], c1[1], c2[1]);
+        m.row[2] = invDet * Vec3(c0[2], c1[2], c2[2]);
+        m.offset = -m.vector(offset);
+        return m;
+    }
+};
+
+#endif
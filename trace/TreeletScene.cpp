@@ -0,0 +1,545 @@
+// implementation code for TreeletScene class
+
+// include this class include file FIRST to ensure that it has
+// everything it needs for internal self-consistency
+#include "TreeletScene.hpp"
+
+// other classes used directly in the implementation
+#include "ObjectList.hpp"
+#include "Ray.hpp"
+#include "Sphere.hpp"
+
+// system includes
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// blocks start on this boundary so each can be paged on its own
+static const uint64_t BlockAlign = 4096;
+
+static const char Magic[8] = { 'T','R','E','E','L','E','T','1' };
+
+// closest t of sphere s along r in (r.near, far), as Sphere::intersect
+static bool hitSphere(const TreeletScene::SphereRecord &s, const Ray &r, Real far, Real &t)
+{
+    Vec3 C(s.center[0], s.center[1], s.center[2]);
+    Real R = s.radius;
+    Real a = r.D_dot_D;
+    Vec3 g = r.E - C;
+    Real b = dot(r.D, g);
+    Real c = dot(g,g) - R*R;
+
+    Real discriminant = b*b - a*c;
+    if (discriminant < 0) return false;
+
+    Real dsq = std::sqrt(discriminant);
+    t = (-b - dsq) / a;
+    if (t > r.near && t < far) return true;
+    t = (-b + dsq) / a;
+    return t > r.near && t < far;
+}
+
+// where r enters box lo-hi before far, if it does
+static bool enterBox(const float lo[3], const float hi[3], const Ray &r, Real far, Real &t)
+{
+    const float *side[2] = { lo, hi };
+    Real near = r.near;
+    for (int a = 0; a < 3; ++a) {
+        Real t0 = (side[r.sign[a]][a] - r.E[a]) * r.invD[a];
+        Real t1 = (side[1 - r.sign[a]][a] - r.E[a]) * r.invD[a];
+        near = t0 > near ? t0 : near;
+        far = t1 < far ? t1 : far;
+    }
+    t = near;
+    return near <= far;
+}
+
+// first and one-past-last slot, and one past the last node, under node
+static void subtree(const BVH &bvh, int node, int &begin, int &end, int &nodeEnd)
+{
+    int first = node;
+    while (!bvh.nodes[first].count)
+        first = first + 1;
+    int last = node;
+    while (!bvh.nodes[last].count)
+        last = bvh.nodes[last].offset;
+    begin = bvh.nodes[first].offset;
+    end = bvh.nodes[last].offset + bvh.nodes[last].count;
+    nodeEnd = last + 1;
+}
+
+// copy the top of bvh into top, cutting off subtrees of at most
+// TreeletSpheres spheres as treelets, given as their root nodes
+static int cutTreelets(const BVH &bvh, int node, std::vector<BVHNode> &top,
+                       std::vector<int> &roots)
+{
+    int index = int(top.size());
+    top.push_back(bvh.nodes[node]);
+
+    int begin, end, nodeEnd;
+    subtree(bvh, node, begin, end, nodeEnd);
+    if (bvh.nodes[node].count || end - begin <= TreeletScene::TreeletSpheres) {
+        top[index].offset = int(roots.size());
+        top[index].count = 1;
+        top[index].axis = 0;
+        roots.push_back(node);
+        return index;
+    }
+
+    cutTreelets(bvh, node + 1, top, roots);
+    int right = cutTreelets(bvh, bvh.nodes[node].offset, top, roots);
+    top[index].offset = right;
+    return index;
+}
+
+bool TreeletScene::write(const char *filename, const std::vector<Object*> &objects)
+{
+    std::vector<SphereRecord> records(objects.size());
+    std::vector<BVHBox> boxes(objects.size());
+    std::map<std::vector<float>, uint32_t> surfaceIndex;
+    std::vector<std::vector<float> > surfaceTable;
+    bool textured = false;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const Sphere *sphere = dynamic_cast<const Sphere*>(objects[i]);
+        if (!sphere) {
+            std::cerr << "treelet files hold only spheres\n";
+            return false;
+        }
+
+        SphereRecord &rec = records[i];
+        Vec3 C = sphere->getCenter();
+        for (int a = 0; a < 3; ++a)
+            rec.center[a] = float(C[a]);
+        rec.radius = float(sphere->getRadius());
+        for (int a = 0; a < 3; ++a) {
+            boxes[i].lo[a] = std::nextafter(rec.center[a] - rec.radius, -INFINITY);
+            boxes[i].hi[a] = std::nextafter(rec.center[a] + rec.radius, INFINITY);
+        }
+
+        const Surface &s = sphere->surface;
+        textured |= s.texture != nullptr;
+        std::vector<float> key = {
+            float(s.ambient[0]), float(s.ambient[1]), float(s.ambient[2]),
+            float(s.diffuse[0]), float(s.diffuse[1]), float(s.diffuse[2]),
+            float(s.specular[0]), float(s.specular[1]), float(s.specular[2]),
+            float(s.e), float(s.kr), float(s.kt), float(s.ir)
+        };
+        auto found = surfaceIndex.find(key);
+        if (found == surfaceIndex.end()) {
+            found = surfaceIndex.insert(std::make_pair(key, uint32_t(surfaceTable.size()))).first;
+            surfaceTable.push_back(key);
+        }
+        rec.surface = found->second;
+    }
+    if (textured)
+        std::cerr << "textures are not kept in treelet files\n";
+
+    BVH bvh;
+    bvh.build(boxes);
+    std::vector<BVHBox>().swap(boxes);
+    std::vector<BVHNode> top;
+    std::vector<int> roots;
+    if (!bvh.nodes.empty())
+        cutTreelets(bvh, 0, top, roots);
+
+    // tables first, then the blocks at aligned offsets
+    Header header;
+    memcpy(header.magic, Magic, sizeof Magic);
+    header.sphereCount = uint32_t(records.size());
+    header.treeletCount = uint32_t(roots.size());
+    header.surfaceCount = uint32_t(surfaceTable.size());
+    header.topCount = uint32_t(top.size());
+    header.surfaceOffset = sizeof(Header);
+    header.topOffset = header.surfaceOffset + surfaceTable.size() * 13 * sizeof(float);
+    header.directoryOffset = header.topOffset + top.size() * sizeof(BVHNode);
+
+    std::vector<Entry> entries(roots.size());
+    uint64_t offset = header.directoryOffset + roots.size() * sizeof(Entry);
+    for (size_t t = 0; t < roots.size(); ++t) {
+        int begin, end, nodeEnd;
+        subtree(bvh, roots[t], begin, end, nodeEnd);
+        const BVHNode &root = bvh.nodes[roots[t]];
+        Entry &e = entries[t];
+        offset = (offset + BlockAlign - 1) / BlockAlign * BlockAlign;
+        e.offset = offset;
+        e.nodeCount = uint32_t(nodeEnd - roots[t]);
+        e.sphereCount = uint32_t(end - begin);
+        e.bytes = uint32_t(e.nodeCount * sizeof(BVHNode) + e.sphereCount * sizeof(SphereRecord));
+        std::copy(root.lo, root.lo + 3, e.lo);
+        std::copy(root.hi, root.hi + 3, e.hi);
+        offset += e.bytes;
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        std::cerr << "can't write " << filename << '\n';
+        return false;
+    }
+    fwrite(&header, sizeof header, 1, fp);
+    for (const auto &s : surfaceTable)
+        fwrite(s.data(), sizeof(float), s.size(), fp);
+    fwrite(top.data(), sizeof(BVHNode), top.size(), fp);
+    fwrite(entries.data(), sizeof(Entry), entries.size(), fp);
+
+    // each block: its subtree with node and slot numbers made local, then
+    // its spheres in slot order
+    std::vector<BVHNode> nodes;
+    std::vector<SphereRecord> block;
+    uint64_t at = header.directoryOffset + entries.size() * sizeof(Entry);
+    for (size_t t = 0; t < roots.size(); ++t) {
+        int begin, end, nodeEnd;
+        subtree(bvh, roots[t], begin, end, nodeEnd);
+        nodes.assign(bvh.nodes.begin() + roots[t], bvh.nodes.begin() + nodeEnd);
+        for (auto &n : nodes)
+            n.offset -= n.count ? begin : roots[t];
+        block.clear();
+        for (int s = begin; s < end; ++s)
+            block.push_back(records[bvh.order[s]]);
+
+        static const char zeros[BlockAlign] = {};
+        fwrite(zeros, 1, size_t(entries[t].offset - at), fp);
+        fwrite(nodes.data(), sizeof(BVHNode), nodes.size(), fp);
+        fwrite(block.data(), sizeof(SphereRecord), block.size(), fp);
+        at = entries[t].offset + entries[t].bytes;
+    }
+
+    bool ok = !ferror(fp);
+    ok &= fclose(fp) == 0;
+    if (!ok)
+        std::cerr << "error writing " << filename << '\n';
+    return ok;
+}
+
+TreeletScene::TreeletScene()
+    : base(nullptr), length(0), spheres(0), cacheBytes(0), residentBytes(0), hand(0),
+      visitCounts(new VisitCount[VisitSlots]()), loads(0), evictions(0), bytesPaged(0)
+{}
+
+TreeletScene::~TreeletScene()
+{
+#ifndef _WIN32
+    if (base)
+        munmap((void*)base, length);
+#endif
+}
+
+bool TreeletScene::open(const char *filename, size_t _cacheBytes)
+{
+#ifdef _WIN32
+    std::cerr << "out-of-core rendering needs mmap\n";
+    return false;
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "can't open " << filename << '\n';
+        return false;
+    }
+    struct stat info;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header))
+        mem = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        std::cerr << "can't map " << filename << '\n';
+        return false;
+    }
+    base = (const unsigned char *)mem;
+    length = size_t(info.st_size);
+
+    // no read-ahead: pages come in when a treelet asks for them
+    madvise(mem, length, MADV_RANDOM);
+
+    Header header;
+    memcpy(&header, base, sizeof header);
+    if (memcmp(header.magic, Magic, sizeof Magic) != 0 ||
+        header.directoryOffset + uint64_t(header.treeletCount) * sizeof(Entry) > length) {
+        std::cerr << filename << " is not a treelet file\n";
+        return false;
+    }
+
+    spheres = header.sphereCount;
+    cacheBytes = _cacheBytes;
+
+    const float *table = (const float *)(base + header.surfaceOffset);
+    surfaces.resize(header.surfaceCount);
+    for (auto &s : surfaces) {
+        s.ambient = Vec3(table[0], table[1], table[2]);
+        s.diffuse = Vec3(table[3], table[4], table[5]);
+        s.specular = Vec3(table[6], table[7], table[8]);
+        s.e = table[9];
+        s.kr = table[10];
+        s.kt = table[11];
+        s.ir = table[12];
+        table += 13;
+    }
+
+    const BVHNode *nodes = (const BVHNode *)(base + header.topOffset);
+    top.nodes.assign(nodes, nodes + header.topCount);
+    const Entry *entries = (const Entry *)(base + header.directoryOffset);
+    directory.assign(entries, entries + header.treeletCount);
+    for (const auto &e : directory)
+        if (e.offset + e.bytes > length) {
+            std::cerr << filename << " is truncated\n";
+            return false;
+        }
+
+    resident.reset(new std::atomic<bool>[directory.size()]());
+    referenced.reset(new std::atomic<bool>[directory.size()]());
+    return true;
+#endif
+}
+
+// tell the kernel a block is about to be read, or can be dropped, rounding
+// it out to whole pages
+static void advise(const unsigned char *start, size_t bytes, bool need)
+{
+#ifndef _WIN32
+    static const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t lo = uintptr_t(start) / page * page;
+    uintptr_t hi = (uintptr_t(start) + bytes + page - 1) / page * page;
+    madvise((void*)lo, hi - lo, need ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+}
+
+// visit count slot of the calling thread, different for each of the first
+// VisitSlots threads to ask
+static int visitSlot(int slots)
+{
+    static std::atomic<int> threads(0);
+    static thread_local int slot = threads++ % slots;
+    return slot;
+}
+
+const unsigned char *TreeletScene::acquire(int t) const
+{
+    visitCounts[visitSlot(VisitSlots)].visits.fetch_add(1, std::memory_order_relaxed);
+
+    // the bit is only written when it changes, so hot treelets stay shared
+    if (!referenced[t].load(std::memory_order_relaxed))
+        referenced[t].store(true, std::memory_order_relaxed);
+    const Entry &e = directory[t];
+
+    if (!resident[t].load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!resident[t].load(std::memory_order_relaxed)) {
+            // make room by dropping treelets not referenced since the hand
+            // last passed; a thread still reading one just faults its
+            // pages back in. Two sweeps at most, the first clearing bits
+            while (cacheBytes && residentBytes + e.bytes > cacheBytes &&
+                   !residentList.empty()) {
+                if (hand >= residentList.size())
+                    hand = 0;
+                int victim = residentList[hand];
+                if (referenced[victim].load(std::memory_order_relaxed)) {
+                    referenced[victim].store(false, std::memory_order_relaxed);
+                    ++hand;
+                    continue;
+                }
+                residentList[hand] = residentList.back();
+                residentList.pop_back();
+                resident[victim].store(false, std::memory_order_relaxed);
+                residentBytes -= directory[victim].bytes;
+                ++evictions;
+                advise(base + directory[victim].offset, directory[victim].bytes, false);
+            }
+
+            advise(base + e.offset, e.bytes, true);
+            residentList.push_back(t);
+            residentBytes += e.bytes;
+            ++loads;
+            bytesPaged += e.bytes;
+            resident[t].store(true, std::memory_order_release);
+        }
+    }
+    return base + e.offset;
+}
+
+bool TreeletScene::traceTreelet(int t, const Ray &r, Real &far, Intersection &hit) const
+{
+    const unsigned char *block = base + directory[t].offset;
+    const BVHNode *nodes = (const BVHNode *)block;
+    const SphereRecord *records =
+        (const SphereRecord *)(block + directory[t].nodeCount * sizeof(BVHNode));
+
+    bool found = false;
+    BVH::closest(nodes, r, far, [&](int first, int count, Real &far) {
+        for (int s = first; s < first + count; ++s) {
+            Real t1;
+            if (hitSphere(records[s], r, far, t1)) {
+                far = t1;
+                hit = Intersection(this, t1, primOf(t, s));
+                found = true;
+            }
+        }
+    });
+    return found;
+}
+
+const Intersection TreeletScene::intersect(const Ray &r) const
+{
+    Intersection hit;
+    Real far = r.far;
+    top.closest(r, far, [&](int t, int, Real &far) {
+        acquire(t);
+        traceTreelet(t, r, far, hit);
+    });
+    return hit;
+}
+
+const Intersection TreeletScene::intersectPrim(const Ray &r, int prim) const
+{
+    acquire(prim / TreeletSpheres);
+    Real t;
+    if (!hitSphere(sphereOf(prim), r, r.far, t))
+        return Intersection();
+    return Intersection(this, t, prim);
+}
+
+Intersection TreeletScene::trace(const Ray &r) const
+{
+    ++RayCounts::current->rays;
+    return intersect(r);
+}
+
+bool TreeletScene::probe(const Ray &r) const
+{
+    ++RayCounts::current->shadows;
+    return top.any(r, [&](int t, int) {
+        const unsigned char *block = acquire(t);
+        const SphereRecord *records =
+            (const SphereRecord *)(block + directory[t].nodeCount * sizeof(BVHNode));
+        return BVH::any((const BVHNode *)block, r, [&](int first, int count) {
+            Real t1;
+            for (int s = first; s < first + count; ++s)
+                if (hitSphere(records[s], r, r.far, t1))
+                    return true;
+            return false;
+        });
+    });
+}
+
+// Each ray lists the treelets its path crosses, nearest first. Rounds then
+// queue every unfinished ray at its next treelet, and each queue is run
+// with its treelet paged in once. A ray is done when its next treelet
+// starts beyond its closest hit.
+void TreeletScene::traceBatch(const Ray *rays, Intersection *hits, int count) const
+{
+    RayCounts::current->rays += count;
+
+    struct Visit { Real t; int treelet; };
+    std::vector<Visit> path;
+    std::vector<int> start(count + 1), next(count);
+    std::vector<Real> far(count);
+    for (int i = 0; i < count; ++i) {
+        const Ray &r = rays[i];
+        start[i] = int(path.size());
+        Real reach = r.far;
+        top.closest(r, reach, [&](int t, int, Real &) {
+            Visit v;
+            v.treelet = t;
+            if (enterBox(directory[t].lo, directory[t].hi, r, r.far, v.t))
+                path.push_back(v);
+        });
+        std::sort(path.begin() + start[i], path.end(),
+                  [](const Visit &a, const Visit &b) { return a.t < b.t; });
+        next[i] = start[i];
+        far[i] = r.far;
+        hits[i] = Intersection();
+    }
+    start[count] = int(path.size());
+
+    // (treelet, ray) pairs, sorted so each treelet's queue is contiguous
+    std::vector<std::pair<int,int> > queue;
+    for (;;) {
+        queue.clear();
+        for (int i = 0; i < count; ++i)
+            if (next[i] < start[i+1] && path[next[i]].t <= far[i])
+                queue.push_back(std::make_pair(path[next[i]].treelet, i));
+        if (queue.empty()) break;
+        std::sort(queue.begin(), queue.end());
+
+        for (size_t q = 0; q < queue.size(); ) {
+            int t = queue[q].first;
+            acquire(t);
+            for (; q < queue.size() && queue[q].first == t; ++q) {
+                int i = queue[q].second;
+                traceTreelet(t, rays[i], far[i], hits[i]);
+                ++next[i];
+            }
+        }
+    }
+}
+
+size_t TreeletScene::bytes() const
+{
+    return top.nodes.capacity() * sizeof(BVHNode)
+        + directory.capacity() * sizeof(Entry)
+        + surfaces.capacity() * sizeof(Surface)
+        + directory.size() * 2 * sizeof(std::atomic<bool>)
+        + VisitSlots * sizeof(VisitCount);
+}
+
+const TreeletScene::SphereRecord &TreeletScene::sphereOf(int prim) const
+{
+    int t = prim / TreeletSpheres, s = prim % TreeletSpheres;
+    const unsigned char *block = base + directory[t].offset;
+    const SphereRecord *records =
+        (const SphereRecord *)(block + directory[t].nodeCount * sizeof(BVHNode));
+    return records[s];
+}
+
+// hits always carry a sphere, so this is only a fallback
+const Vec3 TreeletScene::normal(const Vec3 P) const
+{
+    return normal(P, 0);
+}
+
+const Vec3 TreeletScene::normal(const Vec3 P, int prim) const
+{
+    const SphereRecord &s = sphereOf(prim);
+    return normalize(P - Vec3(s.center[0], s.center[1], s.center[2]));
+}
+
+const Surface &TreeletScene::surfaceOf(int prim) const
+{
+    return surfaces[sphereOf(prim).surface];
+}
+
+// the mapping stays where it is; the scene is never in an arena
+Object *TreeletScene::relocate(SceneArena &)
+{
+    return this;
+}
+
+void TreeletScene::bounds(Vec3 &lo, Vec3 &hi) const
+{
+    top.bounds(lo, hi);
+}
+
+void TreeletScene::printStats() const
+{
+    unsigned long long v = 0, l = loads;
+    for (int k = 0; k < VisitSlots; ++k)
+        v += visitCounts[k].visits.load(std::memory_order_relaxed);
+    std::cout << "treelets: " << v << " visit" << (v == 1 ? "" : "s") << ", "
+        << (v ? 100.0 * (v - l) / v : 0.0) << "% resident; "
+        << l << " paged in (" << bytesPaged / (1024.0 * 1024.0) << " MB), "
+        << evictions << " evicted";
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        std::cout << "; " << usage.ru_majflt << " major page faults";
+#endif
+    std::cout << '\n';
+}
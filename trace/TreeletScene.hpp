@@ -0,0 +1,139 @@
+// spheres traced out of core from a memory-mapped treelet file
+#ifndef TREELETSCENE_HPP
+#define TREELETSCENE_HPP
+
+// other classes we use DIRECTLY in our interface
+#include "Accel.hpp"
+#include "BVH.hpp"
+#include "Object.hpp"
+#include "Vec3.hpp"
+
+// system includes necessary for the interface
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// classes we only use by pointer or reference
+class Ray;
+
+// Sphere scene kept on disk as treelets: page-aligned blocks each holding
+// a BVH subtree and the spheres under it. A small top-level BVH over the
+// treelet boxes stays in memory; the file is mapped and only treelets that
+// rays reach are paged in, evicting ones not used lately past the cache
+// size. Batches of rays wait in a queue per treelet, so a treelet is paged
+// in once per round of a batch rather than once per ray.
+//
+// Only rendering runs out of core. write() takes a scene already read
+// into memory, so files are made on a machine with room for the scene.
+//
+// The scene is also the one Object every hit refers to, with the sphere
+// number in Intersection::prim, like the triangles of a Mesh.
+class TreeletScene : public Accel, public Object {
+public: // public data
+    // spheres per treelet at most
+    static const int TreeletSpheres = 1024;
+
+public: // constructors
+    TreeletScene();
+    ~TreeletScene();
+
+    // write the spheres in objects to filename as treelets; false if any
+    // object is not a sphere or the file can't be written. Holds about
+    // twice the spheres' records and boxes in memory while it works
+    static bool write(const char *filename, const std::vector<Object*> &objects);
+
+    // map filename, keeping at most cacheBytes of treelets resident (0 for
+    // no limit); false if it can't be mapped or isn't a treelet file
+    bool open(const char *filename, size_t cacheBytes);
+
+public: // Accel queries
+    Intersection trace(const Ray &r) const override;
+    bool probe(const Ray &r) const override;
+    void traceBatch(const Ray *rays, Intersection *hits, int count) const override;
+
+    // in-memory top level, directory and surfaces; the file is not counted
+    size_t bytes() const override;
+
+public: // object functions
+    const Intersection intersect(const Ray &ray) const override;
+    const Intersection intersectPrim(const Ray &ray, int prim) const override;
+    const Vec3 normal(const Vec3 P) const override;
+    const Vec3 normal(const Vec3 P, int prim) const override;
+    const Surface &surfaceOf(int prim) const override;
+    Object *relocate(SceneArena &arena) override;
+    void bounds(Vec3 &lo, Vec3 &hi) const override;
+
+public: // statistics
+    size_t sphereCount() const { return spheres; }
+    size_t treeletCount() const { return directory.size(); }
+
+    // treelet visits, how many found their treelet resident, and bytes paged
+    void printStats() const;
+
+public: // file layout
+    struct Header {
+        char magic[8];              // "TREELET1"
+        uint32_t sphereCount, treeletCount, surfaceCount, topCount;
+        uint64_t surfaceOffset;     // surfaceCount x 13 floats
+        uint64_t topOffset;         // topCount BVHNodes; leaves hold one treelet
+        uint64_t directoryOffset;   // treeletCount Entries
+    };
+    struct Entry {
+        uint64_t offset;            // page-aligned start of the block
+        uint32_t bytes;             // nodes then spheres
+        uint32_t nodeCount, sphereCount;
+        float lo[3], hi[3];         // bounds of the spheres
+    };
+    struct SphereRecord {
+        float center[3], radius;
+        uint32_t surface;           // index into the surface table
+    };
+
+private:
+    // block for treelet t, paged in and marked as recently used
+    const unsigned char *acquire(int t) const;
+
+    // closest hit in treelet t, lowering far; false if none
+    bool traceTreelet(int t, const Ray &r, Real &far, Intersection &hit) const;
+
+    // prim number for sphere s of treelet t, and back
+    static int primOf(int t, int s) { return t * TreeletSpheres + s; }
+    const SphereRecord &sphereOf(int prim) const;
+
+private: // private data
+    const unsigned char *base;      // whole mapped file
+    size_t length;
+    size_t spheres;
+
+    BVH top;                        // over treelet boxes, in memory
+    std::vector<Entry> directory;
+    std::vector<Surface> surfaces;
+
+    // residency, with a CLOCK sweep over the resident treelets for
+    // eviction: each visit sets a treelet's referenced bit, and the hand
+    // clears bits until it finds a treelet not referenced since its last
+    // pass
+    size_t cacheBytes;
+    mutable std::mutex lock;                        // guards the three below
+    mutable std::vector<int> residentList;
+    mutable size_t residentBytes;
+    mutable size_t hand;                            // next in residentList
+    std::unique_ptr<std::atomic<bool>[]> resident;
+    std::unique_ptr<std::atomic<bool>[]> referenced;
+
+    // visits counted by each thread in its own slot, on its own cache line,
+    // and added up for printStats
+    struct VisitCount {
+        std::atomic<unsigned long long> visits;
+        char pad[64 - sizeof(std::atomic<unsigned long long>)];
+    };
+    static const int VisitSlots = 64;
+    std::unique_ptr<VisitCount[]> visitCounts;
+
+    // statistics counted under lock, when treelets come and go
+    mutable std::atomic<unsigned long long> loads, evictions, bytesPaged;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include <cmath>
 #include <istream>
 
 #ifndef INFINITY
@@ -17,21 +18,69 @@
 #define INFINITY float(3.402823466e+38f + 3.402823466e+38f)
 #endif
 
+// scalar type for all scene math, chosen at compile time with TRACE_REAL
+// (trace_f32 and trace_f64 targets, see CMakeLists.txt)
+#ifndef TRACE_REAL
+#define TRACE_REAL float
+#endif
+typedef TRACE_REAL Real;
+
+// SSE backend for float vectors selected at compile time with TRACE_SSE
+#if defined(TRACE_SSE) && (defined(__SSE2__) || defined(_M_X64))
+#define VEC3_SSE 1
+#include <emmintrin.h>
+#endif
+
 //////////////////////////////////////////////////////////////////////
-// 3D vector
-class Vec3 {
+// 3D vector with components of type T
+template <typename T>
+class Vec3T {
 public: // private data
-    float data[3];                          // array data
+    T data[3];                              // array data
 
 public: // constructors & destructors
-    Vec3() { data[0] = data[1] = data[2] = 0; }
-    Vec3(float _x, float _y, float _z) { 
-        data[0] = _x; 
-        data[1] = _y; 
+    Vec3T() { data[0] = data[1] = data[2] = 0; }
+    Vec3T(T _x, T _y, T _z) {
+        data[0] = _x;
+        data[1] = _y;
         data[2] = _z;
     }
     // also can use default copy constructor
 
+public:
+    // access as an array vec[i] rather than vec.data[i]
+    T operator[](int i) const { return data[i]; }
+    T &operator[](int i) { return data[i]; }
+
+    // as color, scaled and clamped to 0-255
+    int r() const {
+        return data[0]<0 ? 0 : (data[0]>1 ? 255 : int(255*data[0] + .5));
+    }
+    int g() const {
+        return data[1]<0 ? 0 : (data[1]>1 ? 255 : int(255*data[1] + .5));
+    }
+    int b() const {
+        return data[2]<0 ? 0 : (data[2]>1 ? 255 : int(255*data[2] + .5));
+    }
+};
+
+#ifdef VEC3_SSE
+// float vectors live in one padded, aligned SSE register
+template <>
+class alignas(16) Vec3T<float> {
+public: // private data
+    union {
+        __m128 m;                           // SSE register layout
+        float data[4];                      // xyz, with w kept at zero
+    };
+
+public: // constructors & destructors
+    Vec3T() : m(_mm_setzero_ps()) {}
+    Vec3T(float _x, float _y, float _z) : m(_mm_set_ps(0, _z, _y, _x)) {}
+    explicit Vec3T(__m128 _m) : m(_m) {}
+    Vec3T(const Vec3T &v) : m(v.m) {}
+    Vec3T &operator=(const Vec3T &v) { m = v.m; return *this; }
+
 public:
     // access as an array vec[i] rather than vec.data[i]
     float operator[](int i) const { return data[i]; }
@@ -48,75 +97,189 @@ public:
         return data[2]<0 ? 0 : (data[2]>1 ? 255 : int(255*data[2] + .5));
     }
 };
+#endif
+
+// vector of the scene scalar type
+typedef Vec3T<Real> Vec3;
 
 //////////////////////////////
 // component-wise operations: -v, v1+v2, v1-v2, v1*v2, v1/v2
 // operations with a scalar: s*v, v*s, v/s
 // vector operations: cross(v1,v2), dot(v1,v2), length(v), normalize(v)
+// fused operations: normalize_len(v,len), reflect(d,n), refract(v,n,ir,t)
 
 // negate v
-inline Vec3 operator-(const Vec3 &v) {
-    return Vec3(-v[0], -v[1], -v[2]);
+template <typename T>
+inline Vec3T<T> operator-(const Vec3T<T> &v) {
+    return Vec3T<T>(-v[0], -v[1], -v[2]);
 }
 
 // vector addition, v1+v2
-inline Vec3 operator+(const Vec3 &v1, const Vec3 &v2) {
-    return Vec3(v1[0] + v2[0], v1[1] + v2[1], v1[2] + v2[2]);
+template <typename T>
+inline Vec3T<T> operator+(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return Vec3T<T>(v1[0] + v2[0], v1[1] + v2[1], v1[2] + v2[2]);
 }
 
 // vector subtraction, v1-v2
-inline Vec3 operator-(const Vec3 &v1, const Vec3 &v2) {
-    return Vec3(v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2]);
+template <typename T>
+inline Vec3T<T> operator-(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return Vec3T<T>(v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2]);
 }
 
 // vector component-wise multiplication, v1*v2
-inline Vec3 operator*(const Vec3 &v1, const Vec3 &v2) {
-    return Vec3(v1[0] * v2[0], v1[1] * v2[1], v1[2] * v2[2]);
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return Vec3T<T>(v1[0] * v2[0], v1[1] * v2[1], v1[2] * v2[2]);
 }
 
 // vector component-wise division, v1/v2
-inline Vec3 operator/(const Vec3 &v1, const Vec3 &v2) {
-    return Vec3(v1[0] / v2[0], v1[1] / v2[1], v1[2] / v2[2]);
+template <typename T>
+inline Vec3T<T> operator/(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return Vec3T<T>(v1[0] / v2[0], v1[1] / v2[1], v1[2] / v2[2]);
 }
 
 // scalar multiplication, s*v
-inline Vec3 operator*(float s, const Vec3 &v) {
-    return Vec3(s*v[0], s*v[1], s*v[2]);
+template <typename T>
+inline Vec3T<T> operator*(T s, const Vec3T<T> &v) {
+    return Vec3T<T>(s*v[0], s*v[1], s*v[2]);
 }
 
 // scalar multiplication, v*s
-inline Vec3 operator*(const Vec3 &v, float s) {
-    return Vec3(s*v[0], s*v[1], s*v[2]);
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T> &v, T s) {
+    return Vec3T<T>(s*v[0], s*v[1], s*v[2]);
+}
+
+// cross product, cross(v1,v2)
+template <typename T>
+inline Vec3T<T> cross(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return Vec3T<T>(v1[1]*v2[2] - v1[2]*v2[1],
+                    v1[2]*v2[0] - v1[0]*v2[2],
+                    v1[0]*v2[1] - v1[1]*v2[0]);
+}
+
+// vector dot product, dot(v1,v2)
+template <typename T>
+inline T dot(const Vec3T<T> &v1, const Vec3T<T> &v2) {
+    return (v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2]);
 }
 
-// scalar division, v/s
-inline Vec3 operator/(const Vec3 &v, float s) {
-    return v*(1/s);
+#ifdef VEC3_SSE
+// SSE overloads, preferred over the templates above for float vectors
+
+// negate v
+inline Vec3T<float> operator-(const Vec3T<float> &v) {
+    return Vec3T<float>(_mm_sub_ps(_mm_setzero_ps(), v.m));
+}
+
+// vector addition, v1+v2
+inline Vec3T<float> operator+(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    return Vec3T<float>(_mm_add_ps(v1.m, v2.m));
+}
+
+// vector subtraction, v1-v2
+inline Vec3T<float> operator-(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    return Vec3T<float>(_mm_sub_ps(v1.m, v2.m));
+}
+
+// vector component-wise multiplication, v1*v2
+inline Vec3T<float> operator*(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    return Vec3T<float>(_mm_mul_ps(v1.m, v2.m));
+}
+
+// vector component-wise division, v1/v2
+// w is 0/0 here, so mask it back to zero
+inline Vec3T<float> operator/(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    const __m128 xyz = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    return Vec3T<float>(_mm_and_ps(_mm_div_ps(v1.m, v2.m), xyz));
+}
+
+// scalar multiplication, s*v
+inline Vec3T<float> operator*(float s, const Vec3T<float> &v) {
+    return Vec3T<float>(_mm_mul_ps(_mm_set1_ps(s), v.m));
+}
+
+// scalar multiplication, v*s
+inline Vec3T<float> operator*(const Vec3T<float> &v, float s) {
+    return Vec3T<float>(_mm_mul_ps(_mm_set1_ps(s), v.m));
 }
 
 // cross product, cross(v1,v2)
-inline Vec3 cross(const Vec3 &v1, const Vec3 &v2) {
-    return Vec3(v1[1]*v2[2] - v1[2]*v2[1],
-                v1[2]*v2[0] - v1[0]*v2[2],
-                v1[0]*v2[1] - v1[1]*v2[0]);
+inline Vec3T<float> cross(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    __m128 a_yzx = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3,0,2,1));
+    __m128 b_yzx = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3,0,2,1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(v1.m, b_yzx), _mm_mul_ps(a_yzx, v2.m));
+    return Vec3T<float>(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3,0,2,1)));
 }
 
 // vector dot product, dot(v1,v2)
-inline float dot(const Vec3 &v1, const Vec3 &v2) {
-    return (v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2]);
+// summed in the same order as the scalar version for identical results
+inline float dot(const Vec3T<float> &v1, const Vec3T<float> &v2) {
+    __m128 p = _mm_mul_ps(v1.m, v2.m);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1,1,1,1));
+    __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2,2,2,2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+#endif
+
+// scalar multiplication and division with mixed literals, s*v, v*s, v/s
+// (e.g. 2*v or v/2.0 with any Vec3T)
+template <typename T, typename S>
+inline Vec3T<T> operator*(S s, const Vec3T<T> &v) {
+    return T(s) * v;
+}
+template <typename T, typename S>
+inline Vec3T<T> operator*(const Vec3T<T> &v, S s) {
+    return T(s) * v;
+}
+template <typename T, typename S>
+inline Vec3T<T> operator/(const Vec3T<T> &v, S s) {
+    return v*(1/T(s));
 }
 
 // return Euclidean vector length, length(v)
-inline float length(const Vec3 &v) {
-    return sqrtf(dot(v, v));
+template <typename T>
+inline T length(const Vec3T<T> &v) {
+    return std::sqrt(dot(v, v));
 }
 
 // return normalized vector, normalize(v)
-inline Vec3 normalize(const Vec3 &v) {
+template <typename T>
+inline Vec3T<T> normalize(const Vec3T<T> &v) {
     return v / length(v);
 }
 
-inline std::istream& operator>>(std::istream &stream, Vec3 &v) {
+// normalize v and return its original length in len
+template <typename T>
+inline Vec3T<T> normalize_len(const Vec3T<T> &v, T &len) {
+    len = length(v);
+    return v * (1/len);
+}
+
+// reflect direction d about normal n
+template <typename T>
+inline Vec3T<T> reflect(const Vec3T<T> &d, const Vec3T<T> &n) {
+    return d - (2*dot(n, d))*n;
+}
+
+// refract the unit view vector v (pointing away from the surface) through
+// a surface with normal n and index of refraction ir, entering if v is on
+// the side n points to. Returns false on total internal reflection,
+// otherwise sets t to the transmitted ray direction.
+template <typename T>
+inline bool refract(const Vec3T<T> &v, const Vec3T<T> &n, T ir, Vec3T<T> &t) {
+    T ci = dot(n, v);                       // cosine of incident ray angle
+    T tir = ci > 0 ? 1/ir : ir;             // ratio of air to object or object to air
+    T ct2 = 1-(1-ci*ci)*tir*tir;            // cosine squared of refracted ray
+    if (ct2 <= 0)
+        return false;
+    T ct = std::sqrt(ct2);
+    t = n*(ci*tir + (ci > 0 ? -ct : ct)) - v*tir;
+    return true;
+}
+
+template <typename T>
+inline std::istream& operator>>(std::istream &stream, Vec3T<T> &v) {
     std::streampos before = stream.tellg();
     if (!(stream >> v[0] >> v[1] >> v[2])) {
         // reset stream to position before read on failure
@@ -7,8 +7,15 @@
 #include "World.hpp"
 
 // local includes
+#include "BVH.hpp"
+#include "Group.hpp"
+#include "Instance.hpp"
+#include "Mesh.hpp"
 #include "Polygon.hpp"
+#include "Profile.hpp"
 #include "Sphere.hpp"
+#include "Texture.hpp"
+#include "Transform.hpp"
 
 // system includes
 #include <math.h>
@@ -16,33 +23,216 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <ctype.h>
 
-// scoped global for what is enabled
-unsigned int World::effects = ~0;
+thread_local const Accel *World::replica = nullptr;
+
+typedef std::map<std::string, Surface> SurfaceMap;
+
+// files smaller than this are read statement by statement
+static const std::streamoff ChunkedParseBytes = 4 << 20;
+
+struct World::ParseState {
+    // surfaces by name, shared with chunks of objects read before the
+    // next change, and the one surface statements change
+    std::shared_ptr<SurfaceMap> surfaces;
+    bool shared;
+    std::string currentName;
+    Surface *currentSurface;
+
+    // textures by file name, so surfaces can share them
+    std::map<std::string, Texture*> textureMap;
+
+    // groups by name, and where new objects go: the open group or the world
+    std::map<std::string, Group*> groupMap;
+    Group *currentGroup;
+    ObjectList *target;
+
+    int spheres, polygons, meshes, instances;
+
+    ParseState(ObjectList *objects)
+        : surfaces(std::make_shared<SurfaceMap>()), shared(false),
+          currentSurface(&(*surfaces)[""]), currentGroup(nullptr), target(objects),
+          spheres(0), polygons(0), meshes(0), instances(0) {}
+};
+
+// Sphere and polygon statements make one object each from a surface named
+// in them and change nothing else, so runs of them can be read in any
+// order; false for any other token. Objects go to out if effects enable
+// them. A surface that isn't defined yet has the default values.
+static bool parseObject(const std::string &token, std::istream &in,
+                        const SurfaceMap &surfaces, unsigned int effects,
+                        SceneArena &arena, std::vector<Object*> &out,
+                        int &spheres, int &polygons)
+{
+    static const Surface none;
+    std::string surfname;
+
+    if (token == "polygon") {
+        in >> surfname;
+        auto found = surfaces.find(surfname);
+        Polygon *poly = arena.make<Polygon>(found != surfaces.end() ? found->second : none);
+        Vec3 vert;
+        while (in >> vert)
+            poly->addVertex(vert);
+        in.clear();
+        poly->closePolygon();
+        if ((effects & World::POLYGONS)) {
+            ++polygons;
+            out.push_back(poly);
+        }
+        return true;
+    }
+
+    if (token == "sphere") {
+        Real radius;
+        Vec3 center;
+        in >> surfname >> radius >> center;
+        if ((effects & World::SPHERES)) {
+            auto found = surfaces.find(surfname);
+            ++spheres;
+            out.push_back(arena.make<Sphere>(found != surfaces.end() ? found->second : none,
+                                             center, radius));
+        }
+        return true;
+    }
+    return false;
+}
+
+// statements other than sphere and polygon, which change what follows
+static bool isStatement(const std::string &token)
+{
+    static const char *const words[] = {
+        "maxdepth", "cutoff", "background", "eyep", "lookp", "up", "fov",
+        "screen", "surface", "ambient", "diffuse", "specular", "specpow",
+        "reflect", "transp", "index", "texture", "light", "mesh", "group",
+        "end", "instance"
+    };
+    for (const char *word : words)
+        if (token == word)
+            return true;
+    return false;
+}
+
+// istream over text already in memory, without copying it
+struct MemoryBuffer : std::streambuf {
+    MemoryBuffer(const char *begin, const char *end) {
+        setg(const_cast<char*>(begin), const_cast<char*>(begin), const_cast<char*>(end));
+    }
+};
 
 // read input file
-World::World(std::istream &ifile)
+World::World(std::istream &ifile, const Options &options)
+    : effects(options.effects)
 {
-    int SphereCount = 0, PolyCount = 0;
+    PROFILE_SCOPE("parse");
     objects = new ObjectList();
-    treeObjects = new ObjectList();
+    accel = nullptr;
+    clearScene();
+
+    // a large file that can be read whole is read in chunks on several
+    // threads; others, or one that can't be split, statement by statement
+    int threads = options.parseThreads > 0 ? options.parseThreads :
+                  int(std::thread::hardware_concurrency());
+    std::string text;
+    std::streampos start = ifile.tellg();
+    if (threads > 1 && start != std::streampos(-1) && ifile.seekg(0, std::ios::end)) {
+        std::streamoff size = ifile.tellg() - start;
+        ifile.seekg(start);
+        if (size >= ChunkedParseBytes) {
+            text.resize(size_t(size));
+            ifile.read(&text[0], size);
+            text.resize(size_t(ifile.gcount()));
+        }
+    }
+    ifile.clear();
 
-    // world state defaults
+    std::unique_ptr<ParseState> state(new ParseState(objects));
+    if (text.empty())
+        parse(ifile, *state, options);
+    else if (!parseChunks(text, *state, options, threads)) {
+        std::cerr << "reading serially\n";
+        clearScene();
+        state.reset(new ParseState(objects));
+        MemoryBuffer buffer(text.data(), text.data() + text.size());
+        std::istream whole(&buffer);
+        parse(whole, *state, options);
+    }
+
+    // fit the textures in the budget by giving up their finest levels,
+    // always from the texture using the most memory
+    size_t textureBytes = 0;
+    int dropped = 0;
+    for (auto texture : textures)
+        textureBytes += texture->bytes();
+    while (options.textureBudget && textureBytes > options.textureBudget) {
+        Texture *largest = nullptr;
+        for (auto texture : textures)
+            if (texture->levels.size() > 1 &&
+                (!largest || texture->bytes() > largest->bytes()))
+                largest = texture;
+        if (!largest) break;
+        textureBytes -= largest->bytes();
+        largest->dropFinest();
+        textureBytes += largest->bytes();
+        ++dropped;
+    }
+    if (!textures.empty())
+        std::cout << textures.size() << " Texture" << (textures.size() == 1 ? "" : "s")
+            << ", " << textureBytes << " bytes"
+            << (dropped ? " after dropping " + std::to_string(dropped) + " mip levels" : "")
+            << '\n';
+
+    // effects are fixed from here on, so pick the matching shading kernel
+    shade = Object::shadeKernel(effects);
+
+    setView();
+
+    int SphereCount = state->spheres, PolyCount = state->polygons;
+    int MeshCount = state->meshes, InstanceCount = state->instances;
+    std::cout << objects->objects.size() << " Objects (" 
+        << SphereCount << " Sphere" << (SphereCount == 1 ? "" : "s") << ", " 
+        << PolyCount << " Polygon" << (PolyCount == 1 ? "" : "s") << ", "
+        << MeshCount << " Mesh" << (MeshCount == 1 ? "" : "es") << ", "
+        << InstanceCount << " Instance" << (InstanceCount == 1 ? "" : "s") << "); "
+        << lights.size() << " Light" << (lights.size() == 1 ? "" : "s") << '\n';
+}
+
+// world state defaults, with nothing in the scene
+void World::clearScene()
+{
+    objects->objects.clear();
+    for (auto group : groups)
+        delete group;
+    groups.clear();
+    for (auto texture : textures)
+        delete texture;
+    textures.clear();
+    lights.clear();
+    arena.release();
+
+    background = Vec3(0,0,0);
     eye = Vec3(0,-8,0);
+    look = Vec3(0,0,0);
+    up = Vec3(0,1,0);
+    xfov = yfov = 45;
     width = height = 512;
     maxdepth = 15;
     cutoff = 0.002;
+}
 
+bool World::parse(std::istream &ifile, ParseState &state, const Options &options)
+{
     // temporary variables while parsing
-    Vec3 look(0,0,0), up(0,1,0);
-    float xfov=45, yfov=45;
     std::string surfname;
 
-    // map of surface names to colors, only need while parsing
-    std::map<std::string, Surface> surfaceMap;
-    Surface *currentSurface = &surfaceMap[""];
-
     std::string token;
     while(ifile >> token) {
         if (token == "maxdepth")
@@ -64,73 +254,402 @@ World::World(std::istream &ifile)
             ifile >> width >> height;
 
         else if (token == "surface") {
-            ifile >> surfname;
-            currentSurface = &surfaceMap[surfname];
+            ifile >> state.currentName;
+            state.currentSurface = &(*state.surfaces)[state.currentName];
         }
             
         else if (token == "ambient")
-            ifile >> currentSurface->ambient;
+            ifile >> state.currentSurface->ambient;
         else if (token == "diffuse")
-            ifile >> currentSurface->diffuse;
+            ifile >> state.currentSurface->diffuse;
         else if (token == "specular")
-            ifile >> currentSurface->specular;
+            ifile >> state.currentSurface->specular;
         else if (token == "specpow")
-            ifile >> currentSurface->e;
+            ifile >> state.currentSurface->e;
         else if (token == "reflect")
-            ifile >> currentSurface->kr;
+            ifile >> state.currentSurface->kr;
         else if (token == "transp")
-            ifile >> currentSurface->kt;
+            ifile >> state.currentSurface->kt;
         else if (token == "index")
-            ifile >> currentSurface->ir;
+            ifile >> state.currentSurface->ir;
+        else if (token == "texture") {
+            std::string filename;
+            ifile >> filename;
+            Texture *&texture = state.textureMap[filename];
+            if (!texture) {
+                texture = new Texture();
+                if (texture->load(filename.c_str()))
+                    textures.push_back(texture);
+                else {
+                    std::cerr << "can't read texture " << filename << '\n';
+                    delete texture;
+                    texture = nullptr;
+                }
+            }
+            state.currentSurface->texture = texture;
+        }
 
         else if (token == "light") {
-            float intensity;
+            Real intensity;
             Vec3 position;
             ifile >> intensity >> token >> position;
             lights.push_back(Light(Vec3(intensity, intensity, intensity), position));
         }
         
-        //else if (token == "polygon") {
-        //    ifile >> surfname;
-        //    Polygon *poly = new Polygon(surfaceMap[surfname]);
-        //    Vec3 vert;
-        //    while (ifile >> vert)
-        //        poly->addVertex(vert);
-        //    ifile.clear();
-        //    poly->closePolygon();
-        //    if ((World::effects & World::POLYGONS)) {
-        //        ++PolyCount;
-        //        objects.addObject(poly);
-        //    }
-        //}
-
-        else if (token == "sphere") {
-            float radius;
-            Vec3 center;
-            ifile >> surfname >> radius >> center;
-            if ((World::effects & World::SPHERES)) {
-                ++SphereCount;
-                objects->addObject(new Sphere(surfaceMap[surfname], center, radius));
-                treeObjects->addObject(new Sphere(surfaceMap[surfname], center, radius));
+        else if (parseObject(token, ifile, *state.surfaces, effects, arena,
+                             state.target->objects, state.spheres, state.polygons))
+            ;
+
+        // whole OBJ file as one object with the given surface
+        else if (token == "mesh") {
+            std::string filename;
+            ifile >> surfname >> filename;
+            Mesh *mesh = arena.make<Mesh>((*state.surfaces)[surfname]);
+            if (! mesh->load(filename.c_str(), options.compressedMeshes))
+                std::cerr << "can't read mesh " << filename << '\n';
+            else if (mesh->triangleCount() > 0) {
+                ++state.meshes;
+                state.target->addObject(mesh);
+            }
+        }
+
+        // objects up to the matching end are kept in their own space
+        // and only appear in the world through instances
+        else if (token == "group") {
+            ifile >> token;
+            if (state.currentGroup)
+                std::cerr << "group " << token << " inside group "
+                          << state.currentGroup->name << " ignored\n";
+            else if (state.groupMap.count(token))
+                std::cerr << "group " << token << " defined twice\n";
+            else {
+                state.currentGroup = state.groupMap[token] = new Group(token);
+                groups.push_back(state.currentGroup);
+                state.target = &state.currentGroup->objects;
+            }
+        }
+        else if (token == "end") {
+            state.currentGroup = nullptr;
+            state.target = objects;
+        }
+
+        // instance name [translate x y z] [rotate x y z degrees] [scale s]
+        // on one line, transforms applied in order
+        else if (token == "instance") {
+            std::string line, op;
+            ifile >> token;
+            std::getline(ifile, line);
+            std::istringstream args(line);
+
+            Transform toWorld;
+            while (args >> op) {
+                Vec3 v;
+                Real r;
+                if (op == "translate" && args >> v)
+                    toWorld = Transform::translate(v) * toWorld;
+                else if (op == "rotate" && args >> v >> r)
+                    toWorld = Transform::rotate(v, r) * toWorld;
+                else if (op == "scale" && args >> r)
+                    toWorld = Transform::scale(Vec3(r, r, r)) * toWorld;
+                else {
+                    std::cerr << "bad instance transform: " << line << '\n';
+                    break;
+                }
+            }
+
+            auto found = state.groupMap.find(token);
+            if (found == state.groupMap.end())
+                std::cerr << "instance of unknown group " << token << '\n';
+            else if (state.currentGroup)
+                std::cerr << "instance of " << token << " inside group "
+                          << state.currentGroup->name << " ignored\n";
+            else if (!found->second->objects.empty()) {
+                // build the group's structure once, for all its instances
+                found->second->build();
+                ++state.instances;
+                objects->addObject(arena.make<Instance>(found->second, toWorld));
+            }
+        }
+
+        // a statement short of its values stops the file, as the next
+        // token can't be read
+        if (ifile.fail())
+            return false;
+    }
+    return true;
+}
+
+// first word of the line at text[at], and where the next line starts
+static std::string firstWord(const std::string &text, size_t at, size_t &next)
+{
+    size_t end = text.find('\n', at);
+    next = end == std::string::npos ? text.size() : end + 1;
+    while (at < next && (text[at] == ' ' || text[at] == '\t' || text[at] == '\r'))
+        ++at;
+    size_t word = at;
+    while (at < next && !isspace((unsigned char)text[at]))
+        ++at;
+    return text.substr(word, at - word);
+}
+
+// Lines starting with sphere or polygon outside groups, and the number
+// lines after them, form runs of objects; every other line is read in
+// order as usual. Each run keeps the surfaces as they were where it
+// starts and is cut at sphere and polygon lines into chunks, read on the
+// worker threads into arenas of their own. Those objects then go into
+// the world's list where their runs were, and their arenas after the
+// world's, in file order.
+//
+// The split goes by the first word of each line, so a statement that
+// changes state from the middle of a line fails it.
+bool World::parseChunks(const std::string &text, ParseState &state,
+                        const Options &options, int threads)
+{
+    // the runs of objects, and the other lines between them
+    struct Block {
+        size_t begin, end;
+        bool objects;
+    };
+    std::vector<Block> blocks;
+    bool inGroup = false;
+    for (size_t at = 0, next; at < text.size(); at = next) {
+        std::string word = firstWord(text, at, next);
+        bool run = false;
+        if (word.empty() || isdigit((unsigned char)word[0]) ||
+            word[0] == '-' || word[0] == '+' || word[0] == '.')
+            run = !blocks.empty() && blocks.back().objects;
+        else if (word == "group")
+            inGroup = true;
+        else if (word == "end")
+            inGroup = false;
+        else
+            run = !inGroup && (word == "sphere" || word == "polygon");
+
+        if (!blocks.empty() && blocks.back().objects == run)
+            blocks.back().end = next;
+        else {
+            Block block = { at, next, run };
+            blocks.push_back(block);
+        }
+    }
+
+    // chunks of about chunkBytes, each starting on a sphere or polygon
+    struct Chunk {
+        size_t begin, end;
+        std::shared_ptr<const SurfaceMap> surfaces;
+        size_t position;            // where its objects go in the world's list
+        std::vector<Object*> made;
+        int spheres, polygons;
+        bool mixed;                 // found another statement
+        bool failed;                // a sphere or polygon didn't read
+    };
+    std::vector<Chunk> chunks;
+    size_t chunkBytes = std::max<size_t>(1 << 20, text.size() / (size_t(threads) * 8));
+
+    for (const Block &block : blocks) {
+        if (!block.objects) {
+            // surfaces may change, so runs before this keep their own copy
+            if (state.shared) {
+                state.surfaces = std::make_shared<SurfaceMap>(*state.surfaces);
+                state.currentSurface = &(*state.surfaces)[state.currentName];
+                state.shared = false;
             }
+            MemoryBuffer buffer(text.data() + block.begin, text.data() + block.end);
+            std::istream lines(&buffer);
+            if (!parse(lines, state, options))
+                break;      // the scene ends here, as read serially
+            continue;
         }
+        if (state.currentGroup) {
+            std::cerr << "a group opened mid-line, ";
+            return false;
+        }
+
+        state.shared = true;
+        for (size_t at = block.begin; at < block.end; ) {
+            // the first sphere or polygon line past chunkBytes on
+            size_t end = std::min(block.end, at + chunkBytes), next;
+            if (end < block.end) {
+                size_t newline = text.find('\n', end);
+                end = newline == std::string::npos ? block.end : std::min(block.end, newline + 1);
+            }
+            while (end < block.end) {
+                std::string word = firstWord(text, end, next);
+                if (word == "sphere" || word == "polygon")
+                    break;
+                end = next;
+            }
+            Chunk chunk = { at, end, state.surfaces, objects->objects.size(),
+                            std::vector<Object*>(), 0, 0, false, false };
+            chunks.push_back(chunk);
+            at = end;
+        }
+    }
+
+    // read the chunks, each into its own arena
+    std::vector<std::unique_ptr<SceneArena> > arenas(chunks.size());
+    std::atomic<size_t> nextChunk(0);
+    auto reader = [&]{
+        for (size_t c = nextChunk++; c < chunks.size(); c = nextChunk++) {
+            PROFILE_SCOPE("parse chunk");
+            Chunk &chunk = chunks[c];
+            arenas[c].reset(new SceneArena());
+            MemoryBuffer buffer(text.data() + chunk.begin, text.data() + chunk.end);
+            std::istream lines(&buffer);
+            std::string token;
+            while (!chunk.mixed && !chunk.failed && lines >> token) {
+                if (!parseObject(token, lines, *chunk.surfaces, effects, *arenas[c],
+                                 chunk.made, chunk.spheres, chunk.polygons))
+                    chunk.mixed = isStatement(token);
+                chunk.failed = lines.fail();
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::min(threads, int(chunks.size())); ++t)
+        pool.push_back(std::thread(reader));
+    for (auto &thread : pool)
+        thread.join();
+
+    // statements after a failed chunk have already been read, so the
+    // file is read again to end the scene where it failed
+    for (const Chunk &chunk : chunks)
+        if (chunk.mixed || chunk.failed) {
+            std::cerr << (chunk.mixed ? "statements among the spheres and polygons"
+                                      : "a sphere or polygon short of its values")
+                      << ", ";
+            return false;
+        }
+
+    // the chunks' objects in among those read in order
+    std::vector<Object*> merged;
+    size_t at = 0;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        Chunk &chunk = chunks[c];
+        merged.insert(merged.end(), objects->objects.begin() + at,
+                      objects->objects.begin() + chunk.position);
+        at = chunk.position;
+        merged.insert(merged.end(), chunk.made.begin(), chunk.made.end());
+        state.spheres += chunk.spheres;
+        state.polygons += chunk.polygons;
+        arena.append(*arenas[c]);
     }
+    merged.insert(merged.end(), objects->objects.begin() + at, objects->objects.end());
+    objects->objects.swap(merged);
+    return true;
+}
 
-    // compute view basis
+// compute view basis and solve for screen edges
+void World::setView()
+{
     w = eye - look;
     dist = length(w);
     w = normalize(w);
     u = normalize(cross(up, w));
     v = cross(w, u);
 
-    // solve for screen edges
-    right = dist * tanf(xfov * M_PI/360);
+    right = dist * std::tan(Real(xfov * M_PI/360));
     left = -right;
-    top = dist * tanf(yfov * M_PI/360);
+    top = dist * std::tan(Real(yfov * M_PI/360));
     bottom = -top;
+}
 
-    std::cout << objects->objects.size() << " Objects (" 
-        << SphereCount << " Sphere" << (SphereCount == 1 ? "" : "s") << ", " 
-        << PolyCount << " Polygon" << (PolyCount == 1 ? "" : "s") << "); "
-        << lights.size() << " Light" << (lights.size() == 1 ? "" : "s") << '\n';
+// objects are all in the arena, which releases them in one go
+World::~World()
+{
+    delete objects;
+    for (auto group : groups)
+        delete group;
+    for (auto texture : textures)
+        delete texture;
+}
+
+// bytes per primitive in the arena, compared with allocating each object
+// separately with new and keeping a second copy for the acceleration tree
+void World::memoryReport() const
+{
+    size_t count = arena.count();
+    if (count == 0) return;
+
+    // glibc-style malloc: 8 bytes of header, 16-byte granularity, 32 minimum
+    size_t perObject = arena.bytesUsed() / count;
+    size_t chunk = (perObject + 8 + 15) / 16 * 16;
+    if (chunk < 32) chunk = 32;
+    size_t before = 2 * (chunk + sizeof(Object*));
+    size_t after = perObject + sizeof(Object*);
+
+    std::cout << "scene memory: " << arena.bytesUsed() << " bytes used, "
+        << arena.bytesReserved() << " reserved for " << count << " primitives\n"
+        << "  " << after << " bytes/primitive in arena + shared list, "
+        << "vs ~" << before << " bytes/primitive for two separately new'd copies\n";
+
+    // triangle meshes keep their own buffers outside the arena
+    size_t triangles = 0, meshBytes = 0;
+    std::vector<const Object*> all(objects->objects.begin(), objects->objects.end());
+    for (auto group : groups)
+        all.insert(all.end(), group->objects.objects.begin(), group->objects.objects.end());
+    for (auto obj : all) {
+        const Mesh *mesh = dynamic_cast<const Mesh*>(obj);
+        if (mesh) {
+            triangles += mesh->triangleCount();
+            meshBytes += mesh->bytes();
+        }
+    }
+    if (triangles)
+        std::cout << "  meshes: " << triangles << " triangles in " << meshBytes
+            << " bytes, " << meshBytes / triangles << " bytes/triangle\n";
+
+    // primitives stored once versus primitives seen by rays through instances
+    if (!groups.empty()) {
+        size_t grouped = 0, instanced = 0, direct = 0;
+        for (auto group : groups)
+            grouped += group->objects.objects.size();
+        for (auto obj : objects->objects) {
+            const Instance *inst = dynamic_cast<const Instance*>(obj);
+            if (inst) instanced += inst->primitives();
+            else ++direct;
+        }
+        std::cout << "  instancing: " << direct + grouped << " unique primitives, "
+            << direct + instanced << " effective primitives\n";
+    }
+}
+
+// Morton order of one list's objects, moving each into arena
+static void relocateSorted(std::vector<Object*> &objs, SceneArena &arena)
+{
+    std::vector<BVHBox> boxes(objs.size());
+    for (size_t i = 0; i < objs.size(); ++i) {
+        Vec3 lo, hi;
+        objs[i]->bounds(lo, hi);
+        for (int a = 0; a < 3; ++a) {
+            boxes[i].lo[a] = float(lo[a]);
+            boxes[i].hi[a] = float(hi[a]);
+        }
+    }
+    std::vector<uint32_t> codes = BVH::mortonCodes(boxes);
+    std::vector<int> order(objs.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = int(i);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return codes[a] < codes[b]; });
+
+    std::vector<Object*> sorted(objs.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        sorted[i] = objs[order[i]]->relocate(arena);
+    objs.swap(sorted);
+}
+
+// Surfaces are stored in each object, so they move with it. Group contents
+// are sorted within each group, after the top-level objects.
+void World::spatialSort()
+{
+    SceneArena sorted;
+    relocateSorted(objects->objects, sorted);
+    for (auto group : groups) {
+        relocateSorted(group->objects.objects, sorted);
+        group->rebuild();
+    }
+
+    // old arena now holds only moved-from objects and unused parses
+    arena.swap(sorted);
 }
@@ -5,8 +5,13 @@
 // other classes we use DIRECTLY in our interface
 #include "Vec3.hpp"
 #include "ObjectList.hpp"
-#include "KDTree.hpp"
+#include "Accel.hpp"
+#include "Object.hpp"
+#include "SceneArena.hpp"
+#include "Group.hpp"
+#include "Texture.hpp"
 #include <fstream>
+#include <string>
 #include <vector>
 
 struct Light {
@@ -30,7 +35,17 @@ public: // public data
         POLYGONS       = 0x080,
         SPHERES        = 0x100
     };
-    static unsigned int effects;
+    unsigned int effects;
+
+    // how to read a scene
+    struct Options {
+        unsigned int effects;       // POLYGONS and SPHERES pick what is read
+        size_t textureBudget;       // bytes for all texture levels, 0 for no limit
+        bool compressedMeshes;      // meshes build quantized four-wide BVHs
+        int parseThreads;           // threads reading large files, 0 for one per core
+        Options() : effects(~0u), textureBudget(0), compressedMeshes(false),
+                    parseThreads(0) {}
+    };
 
     // image size
     int width, height;
@@ -38,25 +53,94 @@ public: // public data
     // background color
     Vec3 background;
 
-    // view origin and basis parameters
-    Vec3 eye, w, u, v;
-    float dist, left, right, bottom, top;
+    // view as given: eye looking at look, up direction and field of view
+    // in degrees; setView derives the basis and screen edges from these
+    Vec3 eye, look, up;
+    Real xfov, yfov;
+
+    // view basis parameters
+    Vec3 w, u, v;
+    Real dist, left, right, bottom, top;
 
     // ray recursion termination
     int maxdepth;
-    float cutoff;
+    Real cutoff;
 
 
-    // list of objects in the scene
+    // storage for every primitive in the scene
+    SceneArena arena;
+
+    // list of objects in the scene, shared with acceleration structures
     ObjectList *objects;
-    ObjectList* treeObjects;
+
+    // textures used by surfaces, each loaded once
+    std::vector<Texture*> textures;
+
+    // groups referenced by instances in objects, each with its own tree
+    std::vector<Group*> groups;
+
+    // acceleration structure over objects for all rays, if built
+    const Accel *accel;
+
+    // a copy of accel that rays traced on this thread use instead while a
+    // Replica is in scope, such as one on the thread's NUMA node
+    static thread_local const Accel *replica;
+    struct Replica {
+        const Accel *saved;
+        Replica(const Accel *copy) : saved(replica) { if (copy) replica = copy; }
+        ~Replica() { replica = saved; }
+    };
 
     // list of lights
     LightList lights;
 
+    // shading kernel for the effects enabled when the world was read, or
+    // picked again with Object::shadeKernel when they change
+    Object::ShadeKernel shade;
+
 public:                                                     
     // read world data from a file
-    World(std::istream &ifile); 
+    World(std::istream &ifile, const Options &options = Options());
+    ~World();
+
+    // recompute the view basis and screen edges after changing the view
+    void setView();
+
+    // print memory used per primitive by the scene storage
+    void memoryReport() const;
+
+    // move every primitive to fresh storage in Morton order of its center,
+    // so objects close in space are close in memory; call before building
+    // acceleration structures
+    void spatialSort();
+
+    // closest intersection along r, and whether anything is hit between
+    // r.near and r.far, through accel if there is one
+    Intersection trace(const Ray &r) const {
+        const Accel *a = replica ? replica : accel;
+        return a ? a->trace(r) : objects->trace(r);
+    }
+    bool probe(const Ray &r) const {
+        const Accel *a = replica ? replica : accel;
+        return a ? a->probe(r) : objects->probe(r);
+    }
+
+private:
+    // surfaces, groups and counts carried from statement to statement
+    struct ParseState;
+
+    // empty scene with the default view
+    void clearScene();
+
+    // read statements from in, carrying on from state; false if one of
+    // them failed to read, which ends the scene there
+    bool parse(std::istream &in, ParseState &state, const Options &options);
+
+    // read a whole file's text with runs of spheres and polygons split
+    // into chunks read on threads threads; false, with the scene partly
+    // read, if the text can't be split that way or a chunk failed to read
+    bool parseChunks(const std::string &text, ParseState &state,
+                     const Options &options, int threads);
 };
 
 #endif
@@ -0,0 +1,80 @@
+// benchmark for the specialized shading kernels
+// renders a scene with the common effect presets, once with the kernel
+// specialized for the preset and once with the kernel that tests
+// World::effects on every call
+
+// other classes used directly
+#include "TraceContext.hpp"
+
+// standard includes
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// best of runs renders of the whole image with kernel, in seconds
+static double bench(TraceContext &context, Object::ShadeKernel kernel, int runs)
+{
+    World &world = *context.world;
+    std::vector<unsigned char> pixels(3 * size_t(world.width) * world.height);
+    world.shade = kernel;
+
+    double best = 0;
+    for (int r = 0; r < runs; ++r) {
+        Clock::time_point start = Clock::now();
+        context.render((unsigned char (*)[3])pixels.data());
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        std::cerr << "usage: shade_bench scene.ray [width height [runs]]\n";
+        return 1;
+    }
+
+    TraceContext context;
+    if (!context.loadFile(argv[1]) || !context.build())
+        return 1;
+    World &world = *context.world;
+    if (argc > 3) {
+        world.width = atoi(argv[2]);
+        world.height = atoi(argv[3]);
+    }
+    int runs = argc > 4 ? atoi(argv[4]) : 5;
+
+    struct Preset {
+        const char *flags;
+        unsigned int off;           // effects the flags turn off
+    };
+    const Preset presets[] = {
+        { "(none)",                   0 },
+        { "-no-refract",              World::REFRACT },
+        { "-no-shadow",               World::SHADOW },
+        { "-no-refract -no-shadow",   World::REFRACT | World::SHADOW },
+    };
+
+    std::cout << world.width << "x" << world.height << ", best of " << runs << "\n"
+              << std::left << std::setw(24) << "preset" << std::right
+              << std::setw(14) << "specialized" << std::setw(14) << "checked"
+              << std::setw(8) << "gain" << "\n" << std::fixed;
+    unsigned int all = world.effects;
+    for (const Preset &preset : presets) {
+        world.effects = all & ~preset.off;
+        double specialized = bench(context, Object::shadeKernel(world.effects), runs);
+        double checked = bench(context, Object::checkedKernel(), runs);
+        std::cout << std::left << std::setw(24) << preset.flags << std::right
+                  << std::setprecision(3) << std::setw(12) << specialized << " s"
+                  << std::setw(12) << checked << " s"
+                  << std::setprecision(1) << std::setw(7)
+                  << (checked / specialized - 1) * 100 << "%\n";
+    }
+    return 0;
+}
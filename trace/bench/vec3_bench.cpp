@@ -0,0 +1,81 @@
+// microbenchmark for the Vec3 operations shading uses most
+// built as vec3_bench with the SSE backend where there is one and as
+// vec3_bench_scalar without it, so the two can be run side by side
+
+// other classes used directly
+#include "Vec3.hpp"
+
+// standard includes
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+typedef std::chrono::steady_clock Clock;
+typedef Vec3T<float> Vec;
+
+static float first(float f) { return f; }
+static float first(const Vec &v) { return v[0]; }
+
+// nanoseconds per call of op on each pair of inputs, best of several
+// passes; results are stored, not chained, so calls can overlap as they
+// do across the pixels of a tile, and each pass pairs the inputs anew
+template <typename Out, typename Op>
+static double bench(const char *name, const std::vector<Vec> &a,
+                    const std::vector<Vec> &b, int passes, Op op)
+{
+    std::vector<Out> out(a.size());
+    size_t mask = b.size() - 1;     // a power of two
+    double best = 0;
+    for (int p = 0; p < 5; ++p) {
+        Clock::time_point start = Clock::now();
+        for (int r = 0; r < passes; ++r)
+            for (size_t i = 0; i < a.size(); ++i)
+                out[i] = op(a[i], b[(i + r) & mask]);
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count()
+                    / (double(passes) * a.size());
+        if (p == 0 || ns < best)
+            best = ns;
+    }
+
+    // printed so the work can't be optimized away
+    float sink = 0;
+    for (const Out &o : out)
+        sink += first(o);
+    std::cout << "  " << name << "\t" << best << " ns\t(" << sink << ")\n";
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int passes = argc > 1 ? atoi(argv[1]) : 2000;
+
+    // inputs fit in cache, so this times arithmetic, not memory
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coord(-1, 1);
+    std::vector<Vec> a(4096), b(4096);
+    for (size_t i = 0; i < a.size(); ++i) {
+        a[i] = Vec(coord(random), coord(random), coord(random));
+        b[i] = Vec(coord(random), coord(random), coord(random));
+    }
+
+#ifdef VEC3_SSE
+    std::cout << "SSE Vec3\n";
+#else
+    std::cout << "scalar Vec3\n";
+#endif
+    bench<Vec>("normalize", a, b, passes, [](const Vec &u, const Vec &) {
+        return normalize(u);
+    });
+    bench<float>("dot", a, b, passes, [](const Vec &u, const Vec &v) {
+        return dot(u, v);
+    });
+    bench<Vec>("cross", a, b, passes, [](const Vec &u, const Vec &v) {
+        return cross(u, v);
+    });
+    bench<Vec>("reflect", a, b, passes, [](const Vec &u, const Vec &v) {
+        return reflect(u, v);
+    });
+    return 0;
+}
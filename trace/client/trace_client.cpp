@@ -0,0 +1,226 @@
+// command-line client for trace -serve
+// sends request lines to a render server's UNIX socket, saves the images
+// it answers with and reports the latency of each request
+
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static double millis(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// all of data to fd; false if the connection went away
+static bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n <= 0) return false;
+        data += n;  size -= size_t(n);
+    }
+    return true;
+}
+
+// buffered reads of answer headers and bodies from the socket
+class Reader {
+    int fd;
+    std::vector<char> buffer;
+    size_t start, end;
+
+    bool fill() {
+        if (start == end) start = end = 0;
+        if (end == buffer.size()) {
+            if (start == 0) buffer.resize(buffer.size() * 2);
+            else {
+                std::copy(buffer.begin() + start, buffer.begin() + end, buffer.begin());
+                end -= start;  start = 0;
+            }
+        }
+        ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+        if (n <= 0) return false;
+        end += size_t(n);
+        return true;
+    }
+
+public:
+    Reader(int _fd) : fd(_fd), buffer(1 << 16), start(0), end(0) {}
+
+    bool line(std::string &text) {
+        for (;;) {
+            char *first = buffer.data() + start, *last = buffer.data() + end;
+            char *newline = std::find(first, last, '\n');
+            if (newline != last) {
+                text.assign(first, newline);
+                start += size_t(newline - first) + 1;
+                return true;
+            }
+            if (!fill()) return false;
+        }
+    }
+
+    bool bytes(std::vector<char> &data, size_t size) {
+        data.clear();
+        while (data.size() < size) {
+            if (start == end && !fill()) return false;
+            size_t take = std::min(size - data.size(), end - start);
+            data.insert(data.end(), buffer.begin() + start, buffer.begin() + start + take);
+            start += take;
+        }
+        return true;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    const char *socketPath = nullptr, *requestFile = nullptr;
+    std::string prefix = "answer";
+    bool serial = false;
+    for (++argv, --argc;  argc != 0;  ++argv, --argc) {
+        if (strcmp(argv[0], "-o") == 0 && argc > 1) {
+            prefix = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-serial") == 0)
+            serial = true;
+        else if (argv[0][0] == '-' && argv[0][1])
+            break;
+        else if (!socketPath)
+            socketPath = argv[0];
+        else if (!requestFile)
+            requestFile = argv[0];
+        else
+            break;
+    }
+    if (!socketPath || argc != 0) {
+        std::cerr << "Usage: " << progname << " [options] socket [requests]\n"
+            << "options:\n"
+            << "  -o prefix\n"
+            << "    save images as prefixID.ppm (default answer)\n"
+            << "  -serial\n"
+            << "    wait for each answer before sending the next request\n"
+            << "requests are read one per line from the file, or from stdin\n";
+        return 1;
+    }
+
+    // request lines, skipping blank ones, which get no answer
+    std::vector<std::string> requests;
+    std::ifstream file;
+    if (requestFile) {
+        file.open(requestFile);
+        if (!file) {
+            std::cerr << "Error opening " << requestFile << '\n';
+            return 1;
+        }
+    }
+    std::istream &input = requestFile ? file : std::cin;
+    std::string line;
+    while (std::getline(input, line))
+        if (line.find_first_not_of(" \t\r") != std::string::npos)
+            requests.push_back(line);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    // a server that hangs up shows as a failed write, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+        std::cerr << "can't connect to " << socketPath << '\n';
+        return 1;
+    }
+
+    // pipelined: every request goes out at once, answers are read as they
+    // come back; serial: one at a time
+    std::vector<Clock::time_point> sent(requests.size());
+    auto sendRequest = [&](size_t r) {
+        sent[r] = Clock::now();
+        std::string text = requests[r] + '\n';
+        return writeAll(fd, text.data(), text.size());
+    };
+    std::thread sender;
+    if (!serial)
+        sender = std::thread([&]{
+            for (size_t r = 0; r < requests.size(); ++r)
+                if (!sendRequest(r)) return;
+            writeAll(fd, "quit\n", 5);
+        });
+
+    Clock::time_point start = Clock::now();
+    Reader reader(fd);
+    std::vector<double> latencies;
+    std::vector<char> body;
+    int failures = 0;
+    size_t expected = 0;
+    for (size_t r = 0; r < requests.size(); ++r) {
+        if (serial && !sendRequest(r))
+            break;
+        // quit and shutdown close the connection instead of answering
+        if (requests[r] == "quit" || requests[r] == "shutdown")
+            break;
+        ++expected;
+        std::string header;
+        if (!reader.line(header))
+            break;
+
+        char kind[16] = "", id[64] = "";
+        int width = 0, height = 0;
+        double renderMs = 0;
+        size_t size = 0;
+        if (sscanf(header.c_str(), "%15s %63s %d %d %lf %zu",
+                   kind, id, &width, &height, &renderMs, &size) == 6 &&
+            strcmp(kind, "image") == 0) {
+            if (!reader.bytes(body, size))
+                break;
+            std::string name = prefix + id + ".ppm";
+            std::ofstream(name, std::ofstream::binary).write(body.data(), body.size());
+            double latency = millis(Clock::now() - sent[r]);
+            latencies.push_back(latency);
+            std::cout << name << ": " << width << 'x' << height << ", "
+                << latency << " ms latency, " << renderMs << " ms rendering\n";
+        }
+        else {
+            std::cout << header << '\n';
+            ++failures;
+        }
+    }
+    if (serial)
+        writeAll(fd, "quit\n", 5);
+    else
+        sender.join();
+    close(fd);
+    double seconds = millis(Clock::now() - start) / 1000;
+
+    size_t answered = latencies.size() + size_t(failures);
+    if (answered < expected)
+        std::cerr << "connection closed after " << answered << " of "
+            << expected << " answers\n";
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for (double l : latencies) sum += l;
+        std::cout << latencies.size() << " images in " << seconds << " seconds, "
+            << latencies.size() / seconds << " images/second; latency mean "
+            << sum / latencies.size() << " ms, median "
+            << latencies[latencies.size() / 2] << " ms, max "
+            << latencies.back() << " ms\n";
+    }
+    return answered == expected && failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+// checks finest-level texture lookups against bilinear filtering of the
+// image itself, on sizes where neighboring tiles share tile cache slots
+
+// other classes used directly
+#include "Texture.hpp"
+
+// standard includes
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+// write a width x height binary PPM with rgb(x,y) for each texel
+template <class Color>
+static bool writePPM(const char *filename, int width, int height,
+                     std::vector<unsigned char> &rgb, Color color)
+{
+    rgb.resize(size_t(width) * height * 3);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            color(x, y, &rgb[3 * (size_t(y) * width + x)]);
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return false;
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    bool ok = fwrite(rgb.data(), 1, rgb.size(), fp) == rgb.size();
+    return fclose(fp) == 0 && ok;
+}
+
+// bilinear filtering of rgb at (u,v), repeating at the edges
+static void reference(const std::vector<unsigned char> &rgb, int width, int height,
+                      double u, double v, double out[3])
+{
+    double x = u * width - 0.5, y = v * height - 0.5;
+    double fx = std::floor(x), fy = std::floor(y);
+    int x0 = ((int(fx) % width) + width) % width, y0 = ((int(fy) % height) + height) % height;
+    int x1 = (x0 + 1) % width, y1 = (y0 + 1) % height;
+    fx = x - fx;
+    fy = y - fy;
+    for (int c = 0; c < 3; ++c) {
+        auto at = [&](int i, int j) { return rgb[3 * (size_t(j) * width + i) + c] / 255.0; };
+        out[c] = (1 - fy) * ((1 - fx) * at(x0, y0) + fx * at(x1, y0)) +
+                      fy  * ((1 - fx) * at(x0, y1) + fx * at(x1, y1));
+    }
+}
+
+static void check(const char *name, const Texture &texture,
+                  const std::vector<unsigned char> &rgb, int width, int height,
+                  double u, double v)
+{
+    Vec3 got = texture.sample(Real(u), Real(v), Real(1e-6));
+    double want[3];
+    reference(rgb, width, height, u, v, want);
+    for (int c = 0; c < 3; ++c)
+        if (std::fabs(got[c] - want[c]) > 1e-4) {
+            if (++failures <= 10)
+                std::cerr << name << " at (" << u << ", " << v << "): " << got[0] << ' '
+                          << got[1] << ' ' << got[2] << " should be " << want[0] << ' '
+                          << want[1] << ' ' << want[2] << "\n";
+            return;
+        }
+}
+
+int main()
+{
+    const char *filename = "texture_test.ppm";
+    std::vector<unsigned char> rgb;
+
+    // red rows over blue: the lookup straddles two tiles a row of tiles
+    // apart, which land in the same cache slot at 32 tiles per row
+    auto bands = [](int, int y, unsigned char *c) {
+        c[0] = y < 8 ? 255 : 0;
+        c[1] = 0;
+        c[2] = y < 8 ? 0 : 255;
+    };
+    Texture seam;
+    if (!writePPM(filename, 256, 256, rgb, bands) || !seam.load(filename)) {
+        std::cerr << "can't write and read " << filename << "\n";
+        return 1;
+    }
+    check("seam", seam, rgb, 256, 256, 4.0 / 256, 8.0 / 256);
+
+    // noise at widths of 32 tiles and of 32 +/- 1, for vertical and
+    // diagonal neighbors sharing slots, sampled all over
+    std::mt19937 random(7);
+    auto noise = [&](int, int, unsigned char *c) {
+        for (int k = 0; k < 3; ++k)
+            c[k] = (unsigned char)(random() & 0xff);
+    };
+    std::uniform_real_distribution<double> uv(-0.5, 1.5);
+    const int widths[] = { 256, 248, 264 };
+    for (int width : widths) {
+        Texture texture;
+        if (!writePPM(filename, width, 64, rgb, noise) || !texture.load(filename)) {
+            std::cerr << "can't write and read " << filename << "\n";
+            return 1;
+        }
+        for (int i = 0; i < 100000; ++i)
+            check("noise", texture, rgb, width, 64, uv(random), uv(random));
+    }
+    remove(filename);
+
+    if (failures) {
+        std::cerr << failures << " lookups wrong\n";
+        return 1;
+    }
+    std::cout << "texture lookups match the image\n";
+    return 0;
+}
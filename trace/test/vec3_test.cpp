@@ -0,0 +1,100 @@
+// checks the float Vec3 backend, SSE where built with it, against the
+// scalar templates in double precision over random inputs
+
+// other classes used directly
+#include "Vec3.hpp"
+
+// standard includes
+#include <cmath>
+#include <iostream>
+#include <random>
+
+typedef Vec3T<float> Vec;
+typedef Vec3T<double> Ref;
+
+static int failures = 0;
+
+static Ref ref(const Vec &v)
+{
+    return Ref(v[0], v[1], v[2]);
+}
+
+static Vec narrow(const Ref &r)
+{
+    return Vec(float(r[0]), float(r[1]), float(r[2]));
+}
+
+// within float rounding of the reference, relative to scale
+static void check(const char *name, double got, double want, double scale, int i)
+{
+    if (std::fabs(got - want) > 1e-5 * (scale + 1)) {
+        if (++failures <= 10)
+            std::cerr << name << " input " << i << ": " << got
+                      << " should be " << want << "\n";
+    }
+}
+
+static void check(const char *name, const Vec &got, const Ref &want, double scale, int i)
+{
+    for (int c = 0; c < 3; ++c)
+        check(name, got[c], want[c], scale, i);
+}
+
+int main()
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coord(-100, 100);
+
+    const int count = 100000;
+    for (int i = 0; i < count; ++i) {
+        Vec a(coord(random), coord(random), coord(random));
+        Vec b(coord(random), coord(random), coord(random));
+        Ref ra = ref(a), rb = ref(b);
+        double la = length(ra), lb = length(rb);
+
+        check("a+b", a + b, ra + rb, la + lb, i);
+        check("a-b", a - b, ra - rb, la + lb, i);
+        check("a*b", a * b, ra * rb, la * lb, i);
+        check("2*a", 2 * a, 2 * ra, la, i);
+        check("-a", -a, -ra, la, i);
+        check("dot", dot(a, b), dot(ra, rb), la * lb, i);
+        check("cross", cross(a, b), cross(ra, rb), la * lb, i);
+        check("length", length(a), la, la, i);
+        check("normalize", normalize(a), normalize(ra), 1, i);
+
+        float len;
+        Vec n = normalize_len(a, len);
+        check("normalize_len", n, normalize(ra), 1, i);
+        check("normalize_len length", len, la, la, i);
+
+        Vec un = narrow(normalize(rb));
+        check("reflect", reflect(a, un), reflect(ra, ref(un)), la, i);
+
+        // near the critical angle rounding can flip total internal
+        // reflection, and the transmitted direction is ill-conditioned
+        Vec uv = narrow(normalize(ra)), t;
+        Ref rt;
+        double ci = dot(ref(un), ref(uv)), tir = ci > 0 ? 1/1.5 : 1.5;
+        if (std::fabs(1 - (1 - ci*ci)*tir*tir) < 1e-4)
+            continue;
+        bool through = refract(uv, un, 1.5f, t);
+        if (through != refract(ref(uv), ref(un), 1.5, rt)) {
+            if (++failures <= 10)
+                std::cerr << "refract input " << i << ": total internal reflection differs\n";
+        }
+        else if (through)
+            check("refract", t, rt, 1, i);
+    }
+
+#ifdef VEC3_SSE
+    const char *backend = "SSE";
+#else
+    const char *backend = "scalar";
+#endif
+    if (failures) {
+        std::cerr << failures << " mismatches in the " << backend << " Vec3 backend\n";
+        return 1;
+    }
+    std::cout << count << " random inputs match in the " << backend << " Vec3 backend\n";
+    return 0;
+}
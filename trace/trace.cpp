@@ -1,27 +1,120 @@
 // ray tracer main program
-// includes input file parsing and spawning screen pixel rays
+// command line front end to the trace library: parses options, then loads,
+// builds and renders through a TraceContext and writes ppm files
 
 // classes used directly by this file
-#include "ObjectList.hpp"
-#include "Polygon.hpp"
+#include "TraceContext.hpp"
 #include "Sphere.hpp"
-#include "Ray.hpp"
-#include "World.hpp"
-#include "KDTree.hpp"
 #include "Vec3.hpp"
+#include "TileFarm.hpp"
+#include "Texture.hpp"
+#include "RenderServer.hpp"
+#include "Profile.hpp"
+#include "LoadBalance.hpp"
+#include "Numa.hpp"
 
 // standard includes
 #include <vector>
 #include <fstream>
 #include <iostream>
-#include <thread>
 #include <chrono>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
 
 #ifdef _WIN32
 // don't complain about MS-deprecated standard C functions
 #pragma warning( disable: 4996 )
+#include <fcntl.h>
+#include <io.h>
 #endif
 
+// framebuffer for one band of rows and the image region it covers
+struct Band {
+    unsigned char (*pixels)[3];     // bandRows rows of x1-x0 pixels
+    bool shared;                    // pixels visible to forked workers
+    int bandRows;                   // rows rendered per band
+    int x0, y0, x1, y1;             // region of the image to output
+};
+
+// render the region band by band, streaming to a ppm file
+// sets seconds to the time spent rendering
+static bool writeImage(const char *filename, const Renderer &renderer,
+                       const TileFarm &farm, const Band &band, float &seconds)
+{
+    int width = band.x1 - band.x0, height = band.y1 - band.y0;
+    size_t rowBytes = size_t(width) * 3;
+
+    // output header now, then stream pixel data in ppm-file order
+    std::ofstream output(filename, std::ofstream::out | std::ofstream::binary);
+    output << "P6\n" << width << ' ' << height << '\n' << 255 << '\n';
+
+    auto renderStart = std::chrono::high_resolution_clock::now();
+    if (renderer.reproject)
+        renderer.reproject->newFrame(renderer.world);
+    for (int by0 = band.y0; by0 < band.y1; by0 += band.bandRows) {
+        int by1 = std::min(by0 + band.bandRows, band.y1);
+        if (band.shared)
+            farm.render(band.pixels, width, band.x0, by0, band.x1, by1);
+        else
+            renderer.render(band.pixels, width, band.x0, by0, band.x1, by1);
+        PROFILE_SCOPE("output");
+        output.write((const char *)(band.pixels), (by1 - by0) * rowBytes);
+
+        // some measure of progress on band completion
+        if (band.bandRows < height)
+            std::cout << "rows " << by0 << '-' << by1 << '\n';
+    }
+    auto renderEnd = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<float> renderTime = renderEnd - renderStart;
+    seconds = renderTime.count();
+    if (!output) {
+        std::cerr << "Error writing " << filename << '\n';
+        return false;
+    }
+    return true;
+}
+
+// print how work spread over the threads, and write the map if asked
+static bool printBalance(const LoadBalance &balance, const char *mapFile)
+{
+    balance.print(std::cout);
+    balance.printMap(std::cout);
+    if (mapFile) {
+        if (!balance.writeMap(mapFile))
+            return false;
+        std::cout << "wrote tile cost map to " << mapFile << '\n';
+    }
+    return true;
+}
+
+// where each node's band of a width x rows framebuffer ended up
+static void reportPages(const Numa &numa, unsigned char (*pixels)[3],
+                        int width, int rows, int tileSize)
+{
+    int nodeCount = int(numa.nodes.size());
+    int tilesY = (rows + tileSize - 1) / tileSize;
+    size_t local = 0, total = 0;
+    for (int n = 0; n < nodeCount; ++n) {
+        int rowLo = std::min(rows, (n * tilesY + nodeCount - 1) / nodeCount * tileSize);
+        int rowHi = std::min(rows, ((n + 1) * tilesY + nodeCount - 1) / nodeCount * tileSize);
+        if (rowHi <= rowLo) continue;
+        std::vector<size_t> pages = numa.pages(pixels[size_t(rowLo) * width],
+                                               size_t(rowHi - rowLo) * width * 3);
+        if (pages.empty()) {
+            std::cout << "  framebuffer placement unknown (no move_pages)\n";
+            return;
+        }
+        local += pages[n];
+        for (size_t count : pages) total += count;
+    }
+    std::cout << "  " << 100.0 * local / std::max<size_t>(total, 1)
+        << "% of framebuffer pages on the node rendering them\n";
+}
+
 int main(int argc, char **argv)
 {
     auto startTime = std::chrono::high_resolution_clock::now();
@@ -30,6 +123,27 @@ int main(int argc, char **argv)
     // parse command line arguments
     char *filename = nullptr;
     char *progname = argv[0];
+    int sizeW = 0, sizeH = 0;       // image size override, 0 to use file
+    int threads = 0, tileSize = 0;  // 0 for defaults
+    float memLimit = 0;             // framebuffer limit in MB, 0 for none
+    int crop[4] = {0, 0, 0, 0};     // x0 y0 x1 y1, empty for whole image
+    int workers = 1;                // number of forked worker processes
+    bool memReport = false;         // print scene memory use
+    TraceContext::Options options;  // what to load and build
+    const char *accelName = "kd";   // kd, bvh, lbvh or qbvh
+    int frames = 0;                 // animation frames, 0 for a still image
+    float orbit = 0;                // camera turn per animation frame, degrees
+    Renderer::Order order = Renderer::HILBERT;  // tile and pixel order
+    const char *writeTreelets = nullptr;    // convert spheres to this file
+    float treeletCache = 0;                 // resident treelets in MB, 0 for any
+    int samples = 0;                // path-traced samples per pixel, 0 for Whitted
+    float timeBudget = 0;           // ms per frame, 0 for fixed quality
+    const char *serve = nullptr;    // UNIX socket path, or - for stdin
+    const char *traceEvents = nullptr;  // Chrome trace-event file to write
+    bool tileStats = false;         // print worker and tile times
+    const char *tileMap = nullptr;  // tile cost map file, .json or .pgm
+    bool numaPin = false;           // pin workers and split tiles by NUMA node
+    bool numaReplicate = false;     // and copy the tree to each node
     for(++argv, --argc;  argc != 0;  ++argv, --argc) {
         // print usage on -h, -help, -?, --h, --help, etc.
         if (strncmp(argv[0], "-h", 2) == 0 || 
@@ -38,23 +152,125 @@ int main(int argc, char **argv)
             break;
 
         if (strcmp(argv[0], "-no-parallel") == 0)
-            World::effects &= ~World::PARALLEL;
+            options.world.effects &= ~World::PARALLEL;
         else if (strcmp(argv[0], "-no-ambient") == 0)
-            World::effects &= ~World::AMBIENT;
+            options.world.effects &= ~World::AMBIENT;
         else if (strcmp(argv[0], "-no-diffuse") == 0) 
-            World::effects &= ~World::DIFFUSE;
+            options.world.effects &= ~World::DIFFUSE;
         else if (strcmp(argv[0], "-no-specular") == 0)
-            World::effects &= ~World::SPECULAR;
+            options.world.effects &= ~World::SPECULAR;
         else if (strcmp(argv[0], "-no-shadow") == 0)
-            World::effects &= ~World::SHADOW;
+            options.world.effects &= ~World::SHADOW;
         else if (strcmp(argv[0], "-no-reflect") == 0)
-            World::effects &= ~World::REFLECT;
+            options.world.effects &= ~World::REFLECT;
         else if (strcmp(argv[0], "-no-refract") == 0)
-            World::effects &= ~World::REFRACT;
+            options.world.effects &= ~World::REFRACT;
         else if (strcmp(argv[0], "-no-polygons") == 0)
-            World::effects &= ~World::POLYGONS;
+            options.world.effects &= ~World::POLYGONS;
         else if (strcmp(argv[0], "-no-spheres") == 0)
-            World::effects &= ~World::SPHERES;
+            options.world.effects &= ~World::SPHERES;
+        else if (strcmp(argv[0], "-size") == 0 && argc > 3) {
+            sizeW = atoi(argv[1]);
+            sizeH = atoi(argv[2]);
+            argv += 2;  argc -= 2;
+        }
+        else if (strcmp(argv[0], "-threads") == 0 && argc > 2) {
+            threads = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-tile") == 0 && argc > 2) {
+            tileSize = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-mem-limit") == 0 && argc > 2) {
+            memLimit = float(atof(argv[1]));
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-crop") == 0 && argc > 5) {
+            for (int c = 0; c < 4; ++c)
+                crop[c] = atoi(argv[c+1]);
+            argv += 4;  argc -= 4;
+        }
+        else if (strcmp(argv[0], "-workers") == 0 && argc > 2) {
+            workers = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-kd-legacy") == 0)
+            options.kdBuild = KDTree::LEGACY;
+        else if (strcmp(argv[0], "-accel") == 0 && argc > 2 &&
+                 (strcmp(argv[1], "kd") == 0 || strcmp(argv[1], "bvh") == 0 ||
+                  strcmp(argv[1], "lbvh") == 0 || strcmp(argv[1], "qbvh") == 0)) {
+            accelName = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-no-sort") == 0)
+            options.sort = false;
+        else if (strcmp(argv[0], "-write-treelets") == 0 && argc > 2) {
+            writeTreelets = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-treelets") == 0 && argc > 2) {
+            options.treelets = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-pathtrace") == 0 && argc > 2) {
+            samples = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-time-budget") == 0 && argc > 2) {
+            timeBudget = float(atof(argv[1]));
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-serve") == 0 && argc > 2) {
+            serve = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-trace-events") == 0 && argc > 2) {
+            traceEvents = argv[1];
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-numa") == 0)
+            numaPin = true;
+        else if (strcmp(argv[0], "-numa-replicate") == 0)
+            numaPin = numaReplicate = true;
+        else if (strcmp(argv[0], "-tile-stats") == 0)
+            tileStats = true;
+        else if (strcmp(argv[0], "-tile-map") == 0 && argc > 2) {
+            tileMap = argv[1];
+            tileStats = true;
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-treelet-cache") == 0 && argc > 2) {
+            treeletCache = float(atof(argv[1]));
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-animate") == 0 && argc > 2) {
+            frames = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-orbit") == 0 && argc > 2) {
+            orbit = float(atof(argv[1]));
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-reproject") == 0)
+            options.reproject = true;
+        else if (strcmp(argv[0], "-mem-report") == 0)
+            memReport = true;
+        else if (strcmp(argv[0], "-order") == 0 && argc > 2 &&
+                 (strcmp(argv[1], "rows") == 0 || strcmp(argv[1], "morton") == 0 ||
+                  strcmp(argv[1], "hilbert") == 0)) {
+            order = argv[1][0] == 'r' ? Renderer::ROWS :
+                    argv[1][0] == 'm' ? Renderer::MORTON : Renderer::HILBERT;
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-parse-threads") == 0 && argc > 2) {
+            options.world.parseThreads = atoi(argv[1]);
+            ++argv;  --argc;
+        }
+        else if (strcmp(argv[0], "-texture-budget") == 0 && argc > 2) {
+            options.world.textureBudget = size_t(atof(argv[1]) * 1024 * 1024);
+            ++argv;  --argc;
+        }
         else if (argc == 1)
             filename = argv[0];
         else
@@ -70,72 +286,383 @@ int main(int argc, char **argv)
             << "  -no-shadow, -no-reflect, -no-refract\n"
             << "  -no-polygons, -no-spheres\n"
             << "    turn off ray-tracing features\n"
+            << "  -size width height\n"
+            << "    override the image size given in the file\n"
+            << "  -threads n, -tile n\n"
+            << "    worker thread count and tile size in pixels\n"
+            << "  -order rows|morton|hilbert\n"
+            << "    order of tiles in the image and pixels in a tile (default hilbert)\n"
+            << "  -mem-limit MB\n"
+            << "    render in bands of tiles using at most MB of image memory,\n"
+            << "    and of path tracing sums, streaming each band to the output file\n"
+            << "  -crop x0 y0 x1 y1\n"
+            << "    render and output only pixels x0<=x<x1, y0<=y<y1\n"
+            << "  -workers n\n"
+            << "    split rendering across n forked worker processes\n"
+            << "  -kd-legacy\n"
+            << "    build the KD-tree with the original per-node list splitting\n"
+            << "  -accel kd|bvh|lbvh|qbvh\n"
+            << "    top-level structure: KD-tree (default), SAH BVH, linear BVH,\n"
+            << "    or SAH BVH compressed to quantized 4-wide nodes (meshes too)\n"
+            << "  -no-sort\n"
+            << "    keep primitives in file order instead of Morton order\n"
+            << "  -write-treelets file\n"
+            << "    write the scene's spheres to file as treelets and exit; the\n"
+            << "    scene is read into memory first, so convert where it fits\n"
+            << "  -treelets file\n"
+            << "    render spheres out of core from a treelet file, ignoring the\n"
+            << "    scene file's spheres\n"
+            << "  -treelet-cache MB\n"
+            << "    keep at most MB of treelets resident\n"
+            << "  -pathtrace spp\n"
+            << "    path trace spp samples per pixel instead of Whitted ray tracing\n"
+            << "  -time-budget ms\n"
+            << "    finish each frame in about ms, lowering maxdepth and raising\n"
+            << "    cutoff, or taking fewer than spp path samples, to fit\n"
+            << "  -serve socket|-\n"
+            << "    load the scene once and render requests arriving on a UNIX\n"
+            << "    socket, or on stdin with images on stdout (see RenderServer.hpp)\n"
+            << "  -trace-events file\n"
+            << "    write parse, build, tile, trace, shade and output times per\n"
+            << "    thread to file as Chrome trace-event JSON\n"
+            << "  -numa\n"
+            << "    pin worker threads to CPUs, give each NUMA node's workers a\n"
+            << "    band of rows and place that band's pixels on the node\n"
+            << "  -numa-replicate\n"
+            << "    -numa, with a copy of the top-level structure on each node\n"
+            << "  -tile-stats\n"
+            << "    print worker busy and idle time, tile cost percentiles, a\n"
+            << "    critical path estimate and a map of tile cost\n"
+            << "  -tile-map file\n"
+            << "    also write the tile cost map to file, as JSON if it ends\n"
+            << "    in .json, else as a PGM image with one pixel per tile\n"
+            << "  -animate frames\n"
+            << "    move 1% of the spheres in a loop, output in trace000.ppm...\n"
+            << "  -orbit degrees\n"
+            << "    also turn the camera around the look point each frame\n"
+            << "  -reproject\n"
+            << "    reuse primary hits that still hold from the last frame or request\n"
+            << "  -mem-report\n"
+            << "    print scene memory use per primitive\n"
+            << "  -parse-threads n\n"
+            << "    threads reading scene files of 4 MB or more, split into chunks\n"
+            << "    of spheres and polygons (default one per core, 1 to read serially)\n"
+            << "  -texture-budget MB\n"
+            << "    drop the finest mip levels until all textures fit in MB\n"
             << "output in trace.ppm\n";
         return 1;
     }
 
-    // input file from command line or stdin
-    std::ifstream infile(filename);
-    if (!infile) {
-        std::cerr << "Error opening " << filename << '\n';
-        return 1;
+    // stdout carries the images when serving over stdin, so messages go
+    // to stderr instead
+    if (serve && strcmp(serve, "-") == 0)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
+    options.accel = strcmp(accelName, "bvh") == 0 ? TraceContext::SAH_BVH :
+                    strcmp(accelName, "lbvh") == 0 ? TraceContext::LINEAR_BVH :
+                    strcmp(accelName, "qbvh") == 0 ? TraceContext::COMPRESSED_BVH :
+                    TraceContext::KD_TREE;
+    options.treeletCache = size_t(treeletCache * 1024 * 1024);
+    TraceContext context(options);
+    if (traceEvents) {
+#ifdef TRACE_PROFILE
+        Profile::start();
+#else
+        std::cerr << "-trace-events needs a build with TRACE_PROFILE\n";
+        traceEvents = nullptr;
+#endif
     }
 
     // image parameters, camera parameters
-    World world(infile);
-    KDTree tree(world.treeObjects);
-
-    // array of image data in ppm-file order
-    unsigned char (*pixels)[3] = new unsigned char[world.height*world.width][3];
-
-    // spawn a ray for each pixel and place the result in the pixel
-    std::vector<std::thread> threads;
-    for (int j=0; j<world.width; ++j) {
-        // spawn thread per line
-        // capture j by value since it'll change before/during thread execution
-        threads.push_back(std::thread([&, j]{
-            for(int i=0; i<world.width; ++i) {
-
-                // trace new ray
-                float us = world.left + (world.right  - world.left) * (i+0.5f)/world.width;
-                float vs = world.top  + (world.bottom - world.top ) * (j+0.5f)/world.height;
-                Vec3 dir = -world.dist * world.w + us * world.u + vs * world.v;
-
-                Ray ray(world.eye, dir, 1e-4, INFINITY, world.maxdepth, 1);
-                Intersection isect = NULL;
-                tree.traverse(isect, tree._root, ray, ray.E + ray.near * ray.D);
-                Vec3 col = isect.color(world, ray);
-
-                // assign color
-                pixels[j*world.width + i][0] = col.r();
-                pixels[j*world.width + i][1] = col.g();
-                pixels[j*world.width + i][2] = col.b();
-            }
+    if (!context.loadFile(filename))
+        return 1;
+    World &world = *context.world;
+    std::cout << "read in " << context.stats().loadSeconds << " seconds\n";
+    if (sizeW > 0 && sizeH > 0) {
+        world.width = sizeW;
+        world.height = sizeH;
+    }
+
+    if (options.sort) {
+        context.sort();
+        std::cout << "Morton sort: " << world.objects->objects.size()
+            << " objects in " << context.stats().sortSeconds << " seconds\n";
+    }
+
+    if (writeTreelets) {
+        auto writeStart = std::chrono::high_resolution_clock::now();
+        if (!TreeletScene::write(writeTreelets, world.objects->objects))
+            return 1;
+        std::chrono::duration<float> writeTime =
+            std::chrono::high_resolution_clock::now() - writeStart;
+        std::cout << "wrote " << world.objects->objects.size() << " spheres to "
+            << writeTreelets << " in " << writeTime.count() << " seconds\n";
+        return 0;
+    }
+
+    // only the KD-tree supports the edits animation needs
+    if (frames > 0 && (options.accel != TraceContext::KD_TREE || options.treelets)) {
+        std::cerr << "-animate needs -accel kd\n";
+        return 1;
+    }
 
-            // some measure of progress on line *completion*
-            if (j % 32 == 0) std::cout << "line " << j << '\n';
-        }));
+    if (!context.build())
+        return 1;
+    double buildTime = context.stats().buildSeconds;
+    const Accel &tree = context.accel();
+    if (context.treeletScene)
+        std::cout << "Treelets: " << context.treeletScene->sphereCount() << " spheres in "
+            << context.treeletScene->treeletCount() << " treelets, "
+            << tree.bytes() << " bytes in memory\n";
+    else if (context.kdtree)
+        std::cout << "KD-tree: " << context.kdtree->nodes.size() << " nodes, built in "
+            << buildTime << " seconds\n";
+    else if (!context.bvh->qbvh.nodes.empty())
+        std::cout << "Compressed BVH: " << context.bvh->qbvh.nodes.size()
+            << " nodes, built in " << buildTime << " seconds\n";
+    else
+        std::cout << (options.accel == TraceContext::LINEAR_BVH ? "Linear BVH: " : "BVH: ")
+            << context.bvh->bvh.nodes.size() << " nodes, depth " << context.bvh->bvh.depth
+            << ", built in " << buildTime << " seconds\n";
+    if (!context.treeletScene) {
+        std::cout << "  " << tree.bytes() << " bytes, "
+            << double(tree.bytes()) / std::max<size_t>(world.objects->objects.size(), 1)
+            << " bytes/primitive\n";
+    }
+    if (memReport)
+        world.memoryReport();
+
+    Renderer &renderer = *context.renderer;
+    if (threads > 0) renderer.threads = threads;
+    if (tileSize > 0) renderer.tileSize = tileSize;
+    renderer.order = order;
+    renderer.samples = std::max(samples, 0);
+    std::unique_ptr<Numa> numa;
+    if (numaPin && workers > 1)
+        std::cerr << "-numa needs -workers 1\n";
+    else if (numaPin) {
+        numa.reset(new Numa());
+        std::cout << "NUMA: " << numa->nodes.size() << " node"
+            << (numa->nodes.size() == 1 ? "" : "s") << (numa->known ? "" : " assumed") << ',';
+        for (const Numa::Node &node : numa->nodes)
+            std::cout << " node " << node.id << ' ' << node.cpus.size() << " CPUs";
+        std::cout << '\n';
+
+        // animation edits only the original tree
+        if (numaReplicate && frames > 0)
+            std::cerr << "-numa-replicate can't follow -animate edits, sharing one tree\n";
+        else if (numaReplicate && numa->nodes.size() > 1) {
+            if (numa->replicate(tree))
+                std::cout << "  " << tree.bytes() << "-byte structure copied to each node\n";
+            else
+                std::cerr << "this structure can't be copied, sharing one\n";
+        }
+        renderer.numa = numa.get();
+    }
+    std::unique_ptr<LoadBalance> balance;
+    if (tileStats) {
+        balance.reset(new LoadBalance(renderer.tileSize));
+        renderer.balance = balance.get();
+    }
+
+    // scene, tree and renderer stay loaded while requests come in
+    if (serve) {
+        renderer.timeBudget = timeBudget / 1000.0;
+        RenderServer server(world, renderer);
+        if (strcmp(serve, "-") == 0) {
+#ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            server.serve(stdin, stdout);
+        }
+        else if (!server.listen(serve))
+            return 1;
+        if (traceEvents)
+            Profile::write(traceEvents);
+        if (balance)
+            printBalance(*balance, tileMap);
+        ObjectList::printStats(context.counts);
+        Texture::printStats(context.counts);
+        if (context.treeletScene)
+            context.treeletScene->printStats();
+        return 0;
+    }
+
+    // forked workers' hits and timings would stay in the workers
+    if (workers > 1 && renderer.reproject) {
+        std::cerr << "-reproject needs -workers 1, tracing every pixel\n";
+        renderer.reproject = nullptr;
+    }
+    if (workers > 1 && balance) {
+        std::cerr << "-tile-stats needs -workers 1\n";
+        renderer.balance = nullptr;
+        balance.reset();
+    }
+    TileFarm farm(renderer, workers);
+
+    // region of the image to render
+    int x0 = 0, y0 = 0, x1 = world.width, y1 = world.height;
+    if (crop[2] > crop[0] || crop[3] > crop[1]) {
+        x0 = std::max(crop[0], 0);  x1 = std::min(crop[2], world.width);
+        y0 = std::max(crop[1], 0);  y1 = std::min(crop[3], world.height);
+        if (x1 <= x0 || y1 <= y0) {
+            std::cerr << "Crop window is outside the " << world.width << 'x'
+                << world.height << " image\n";
+            return 1;
+        }
+    }
+    int outWidth = x1 - x0, outHeight = y1 - y0;
+
+    // rows per band: whole region, or as many whole tile rows as fit in
+    // memLimit. Path tracing also sums five floats per pixel over the
+    // band, once in total and once in each thread.
+    size_t pixelBytes = 3;
+    if (renderer.samples > 0)
+        pixelBytes += 5 * sizeof(float) * (size_t(renderer.threads) + 1);
+    size_t rowBytes = size_t(outWidth) * pixelBytes;
+    int bandRows = outHeight;
+    if (memLimit > 0) {
+        size_t limitRows = size_t(memLimit * 1024 * 1024) / rowBytes;
+        if (limitRows >= size_t(renderer.tileSize))
+            limitRows -= limitRows % renderer.tileSize;
+        bandRows = int(std::max(size_t(1), std::min(limitRows, size_t(outHeight))));
+        std::cout << "rendering in bands of " << bandRows << " rows ("
+            << bandRows * rowBytes / (1024.f*1024.f) << " MB";
+        if (renderer.samples > 0)
+            std::cout << " with path sums for " << renderer.threads << " threads";
+        std::cout << ")\n";
+    }
+
+    // each band gets its share of the frame's time
+    if (timeBudget > 0)
+        renderer.timeBudget = timeBudget / 1000.0 * bandRows / outHeight;
+
+    // array of image data for one band in ppm-file order
+    // shared with worker processes when there are any
+    size_t bandPixels = size_t(bandRows) * outWidth;
+    unsigned char (*pixels)[3] = nullptr;
+    if (workers > 1)
+        pixels = TileFarm::allocShared(bandPixels);
+    bool shared = pixels != nullptr;
+    if (!shared)
+        pixels = new unsigned char[bandPixels][3];
+    if (numa && numa->nodes.size() > 1) {
+        renderer.firstTouch(pixels, outWidth, x0, 0, x1, bandRows);
+        reportPages(*numa, pixels, outWidth, bandRows, renderer.tileSize);
+    }
+    Band band = { pixels, shared, bandRows, x0, y0, x1, y1 };
 
-        // Not exactly the same as not having any parallel code, but simulate
-        // no parallelism by joining each thread immediately
-        if (!(World::effects & World::PARALLEL))
-            threads.back().join();
+    float renderSeconds = 0;
+    bool ok = true;
+    if (frames == 0)
+        ok = writeImage("trace.ppm", renderer, farm, band, renderSeconds);
+
+    // animation: move a few spheres each frame, update the tree for just
+    // those, and render; edit cost is reported apart from render time
+    std::vector<Sphere*> movers;
+    std::vector<Vec3> homes;
+    if (frames > 0) {
+        int stride = std::max(1, int(world.objects->objects.size()) / 100);
+        for (size_t o = 0; o < world.objects->objects.size(); o += stride) {
+            Sphere *sphere = dynamic_cast<Sphere*>(world.objects->objects[o]);
+            if (sphere) {
+                movers.push_back(sphere);
+                homes.push_back(sphere->getCenter());
+            }
+        }
+        std::cout << "animating " << movers.size() << " of "
+            << world.objects->objects.size() << " objects\n";
     }
+    Vec3 eye0 = world.eye;
+    for (int frame = 0; frame < frames && ok; ++frame) {
+        auto updateStart = std::chrono::high_resolution_clock::now();
+        context.kdtree->resetUpdateStats();
+        Real angle = Real(2 * M_PI) * frame / frames;
+        for (size_t m = 0; m < movers.size(); ++m) {
+            Vec3 lo, hi;
+            Real radius = 4 * movers[m]->getRadius();
+            movers[m]->setCenter(homes[m] +
+                Vec3(radius * std::cos(angle), radius * std::sin(angle), 0));
+            context.kdtree->update(movers[m]);
+            if (context.reprojection) {
+                movers[m]->bounds(lo, hi);
+                context.reprojection->moved(lo, hi);
+            }
+        }
+        std::chrono::duration<float> updateTime =
+            std::chrono::high_resolution_clock::now() - updateStart;
+
+        // turn the eye about the up axis through the look point
+        if (orbit != 0) {
+            Real turn = Real(orbit * M_PI / 180) * frame;
+            Vec3 axis = normalize(world.up), arm = eye0 - world.look;
+            world.eye = world.look + arm * std::cos(turn) +
+                cross(axis, arm) * std::sin(turn) +
+                axis * (dot(axis, arm) * (1 - std::cos(turn)));
+            world.setView();
+        }
 
-    if ((World::effects & World::PARALLEL)) {
-        for (auto &thread : threads) thread.join();
+        char name[32];
+        snprintf(name, sizeof(name), "trace%03d.ppm", frame);
+        float frameSeconds = 0;
+        ok = writeImage(name, renderer, farm, band, frameSeconds);
+        renderSeconds += frameSeconds;
+
+        std::cout << name << ": update " << updateTime.count() * 1000 << " ms ("
+            << context.kdtree->updateStats.relocated << " relocated, "
+            << context.kdtree->updateStats.rebuilds << " subtree rebuilds of "
+            << context.kdtree->updateStats.rebuiltObjects << " objects), render "
+            << frameSeconds * 1000 << " ms";
+        if (context.reprojection)
+            std::cout << ", " << 100 * context.reprojection->reusedFraction()
+                << "% of primary hits reused";
+        std::cout << '\n';
     }
 
-    // write ppm file of pixels
-    std::ofstream output("trace.ppm", std::ofstream::out | std::ofstream::binary);
-    output << "P6\n" << world.width << ' ' << world.height << '\n' << 255 << '\n';
-    output.write((const char *)(pixels), world.height*world.width*3);
+    if (shared)
+        TileFarm::freeShared(pixels, bandPixels);
+    else
+        delete[] pixels;
+    if (!ok)
+        return 1;
 
-    delete[] pixels;
+    if (traceEvents && !Profile::write(traceEvents))
+        return 1;
+    if (balance && !printBalance(*balance, tileMap))
+        return 1;
+    if (numa)
+        std::cout << "NUMA: " << 100.0 * renderer.remoteTiles / std::max(renderer.nodeTiles, 1LL)
+            << "% of tiles rendered away from their node\n";
+    ObjectList::printStats(context.counts);
+    Texture::printStats(context.counts);
+    if (context.treeletScene)
+        context.treeletScene->printStats();
+    if (timeBudget > 0) {
+        std::cout << "time budget " << timeBudget << " ms: reached ";
+        if (samples > 0)
+            std::cout << renderer.reachedSamples << " of " << samples << " samples/pixel";
+        else
+            std::cout << "maxdepth " << renderer.reachedDepth << "-" << renderer.topDepth
+                << " of " << world.maxdepth << ", cutoff " << renderer.reachedCutoff
+                << ", " << 100 * renderer.fullTiles << "% of tiles at full quality";
+        std::cout << (renderer.partial ? " (last step cut short)" : "") << '\n';
+    }
+    if (samples > 0) {
+        TraceContext::Stats stats = context.stats();
+        double rays = double(stats.rays) + stats.shadowRays;
+        std::cout << "path tracing: " << renderer.reachedSamples << " samples/pixel, "
+            << rays / (double(outWidth) * outHeight * std::max(renderer.reachedSamples, 1))
+            << " rays/sample, " << rays / 1e6 / renderSeconds << " Mrays/second";
+        if (renderer.reachedSamples > 1)
+            std::cout << ", RMS noise " << renderer.noise() << "/255";
+        std::cout << '\n';
+    }
+    std::cout << renderSeconds << " seconds rendering, "
+        << double(outWidth) * outHeight * std::max(frames, 1) / 1e6 / renderSeconds
+        << " megapixels/second\n";
 
     auto endTime = std::chrono::high_resolution_clock::now();
     std::chrono::duration<float> elapsed = endTime - startTime;
     std::cout << elapsed.count() << " seconds\n";
     return 0;
 }
-